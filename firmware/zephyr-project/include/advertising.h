@@ -0,0 +1,46 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADVERTISING_H
+#define ADVERTISING_H
+
+#include <zephyr/sys/util.h>
+#include <zephyr/types.h>
+
+#define DEVICE_NAME CONFIG_BT_DEVICE_NAME
+#define DEVICE_NAME_LEN ( sizeof ( DEVICE_NAME ) - 1 )
+#define BT_DEVICE_CYCLING_APPEARANCE 0x012
+
+// Fast after boot or disconnect, then slow to save power
+#define ADV_FAST_MS 30000
+#define ADV_RETRY_MS 100
+
+// Apps get every connection but the one kept for the heart rate strap
+#define ADV_MAX_CONN ( CONFIG_BT_MAX_CONN - IS_ENABLED ( CONFIG_BT_CENTRAL ) )
+
+typedef enum
+{
+    ADV_STOPPED,
+    ADV_DIRECTED,  // High duty to the last bonded central
+    ADV_FAST,
+    ADV_SLOW
+} advMode_t;
+
+void advStart();
+
+#endif  // ADVERTISING_H
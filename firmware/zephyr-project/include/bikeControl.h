@@ -35,6 +35,9 @@
 #define INIT_INC 0x0014
 #define INIT_RES 0x003A
 
+// Incline travel assumed until a move has been measured
+#define INC_DEFAULT_MS_PER_CNT 500
+
 typedef enum
 {
     DECREASE,
@@ -42,6 +45,13 @@ typedef enum
     INCREASE
 } buttonStatus_t;
 
+typedef enum
+{
+    MODE_MANUAL,
+    MODE_ERG,
+    MODE_SIM
+} bikeMode_t;
+
 // Defined in main.c
 typedef int ( *send_msg_callback_t ) ( const cmd_msg_data_t );
 
@@ -51,9 +61,12 @@ buttonStatus_t evaluateButton ( int up, int down );
 void adjustIncline ( buttonStatus_t adj );
 void adjustResistance ( buttonStatus_t adj );
 void updateBikeTgts ( const bike_tgts_t tgts );  // set_targets_callback_t
+void prepositionIncline ( int16_t grade );
+uint32_t inclineTravelMs ( int16_t grade );
 void initBike();
 int new_msg ( uint8_t *buff, size_t len );
 void updateBike();
+void waitBikeInput ( uint32_t timeout_ms );
 bike_data_t getBikeData();
 
 #endif  // BIKE_CONTROL_H
\ No newline at end of file
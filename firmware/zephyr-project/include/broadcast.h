@@ -0,0 +1,65 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/types.h>
+
+// Vendor telemetry broadcast, c0de0100-6a9b-4b1e-9c3f-2f8e5d7a1b60
+#define BT_UUID_BCAST_VAL                                                 \
+    BT_UUID_128_ENCODE ( 0xc0de0100, 0x6a9b, 0x4b1e, 0x9c3f, 0x2f8e5d7a1b60 )
+#define BT_UUID_BCAST BT_UUID_DECLARE_128 ( BT_UUID_BCAST_VAL )
+
+// Periodic train at 2 to 2.5 Hz (1.25 ms units), observers sync once and
+// then only wake for it
+#define BCAST_PER_INT_MIN 320  // 400 ms
+#define BCAST_PER_INT_MAX 400  // 500 ms
+
+// The extended advertising only points observers at the train
+#define BCAST_EXT_INT_MIN 1600  // 1 s, 0.625 ms units
+#define BCAST_EXT_INT_MAX 1920  // 1.2 s
+
+// Snapshot taken this often, unchanged frames are not handed to the radio
+#define BCAST_UPDATE_MS 250
+
+#define BCAST_FRAME_VERSION 1
+
+// Periodic advertising payload, service data after BT_UUID_BCAST
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    uint8_t version;
+    uint8_t seq;  // Changes with the content, repeats can be skipped
+    uint16_t watts;  // 0xFFFF invalid
+    uint16_t rpm;    // 0xFFFF invalid
+    uint16_t incline;  // Bike counts
+    uint8_t resistance;
+    uint32_t elapsed_ms;  // Moving time
+} bcast_frame_t;
+
+#if defined( CONFIG_BT_PER_ADV )
+void bcastStart();
+#else
+static inline void bcastStart()
+{
+}
+#endif
+
+#endif  // BROADCAST_H
@@ -33,15 +33,57 @@ typedef struct
 {
     int16_t incline;     // 0.01% - 0x7FFF invalid
     uint8_t resistance;  // 0.5% - 0xFF invalid
+    uint16_t power;      // 1 W - 0xFFFF invalid
+    int16_t wind;        // 0.001 m/s - 0x7FFF invalid
+    uint8_t crr;         // 0.0001 - 0xFF invalid
+    uint8_t cw;          // 0.01 kg/m - 0xFF invalid
+    uint16_t trace;      // Latency trace ID - 0 untraced
 } bike_tgts_t;
+#define BIKE_TGTS_NONE                                                   \
+    {                                                                    \
+        .incline = 0x7FFF, .resistance = 0xFF, .power = 0xFFFF,          \
+        .wind = 0x7FFF, .crr = 0xFF, .cw = 0xFF, .trace = 0              \
+    }
 typedef void ( *set_targets_callback_t ) ( const bike_tgts_t );
 
+typedef struct
+{
+    uint32_t elapsed_ms;  // Moving time
+    uint32_t distance_m;
+    uint32_t energy_j;
+    uint32_t total_revs;
+    uint16_t avg_watts;
+    uint16_t max_watts;
+    uint16_t np_watts;  // Normalized power
+    uint16_t avg_rpm;
+    uint16_t max_rpm;
+} ride_metrics_t;
+
+// Readings with a capture time, derived fields share their source's
+#define BIKE_SAMPLE_RPM 0x01  // Cadence and power, speed and cranks follow
+#define BIKE_SAMPLE_HR 0x02
+
 typedef struct
 {
     uint16_t disp_res;
     uint16_t watts;
     uint16_t act_rpm;
     uint16_t tgt_inc;
+    uint16_t watts_3s;      // 3s average
+    uint16_t rpm_filt;      // Low-pass filtered cadence
+    uint8_t gear;           // Virtual gear, 0 outside of simulation
+    uint16_t speed_mmps;    // Virtual speed, 0.001 m/s
+    uint32_t wheel_revs;    // Cumulative virtual wheel revolutions
+    uint32_t wheel_evt_ms;  // Uptime of the last whole wheel revolution
+    uint32_t crank_revs;      // Cumulative crank revolutions
+    uint32_t crank_evt_1024;  // Uptime of the last crank revolution, 1/1024 s
+    uint32_t energy_j;        // Work done since boot, never reset
+    uint8_t heart_bpm;        // Strap heart rate, 0 without one
+    uint32_t rpm_ms;          // Uptime cadence was read from the bus
+    uint32_t hr_ms;           // Uptime of the last strap measurement
+    uint8_t stale;            // BIKE_SAMPLE_* older than their limit
+    uint8_t invalid;          // BIKE_SAMPLE_* to be published as missing
+    ride_metrics_t ride;
 } bike_data_t;
 
 #endif  // COMMON_H
\ No newline at end of file
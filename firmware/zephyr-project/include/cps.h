@@ -33,6 +33,11 @@
 
 // 3.57 Cycling Power Feature (GATT Specification Supplement)
 // 3.1 Cycling Power Feature (Cycling Power Service Specification)
+#define BLE_CPS_FEATURE_ACCUMULATED_TORQUE BIT ( 1 )
+#define BLE_CPS_FEATURE_WHEEL_REV BIT ( 2 )
+#define BLE_CPS_FEATURE_CRANK_REV BIT ( 3 )
+#define BLE_CPS_FEATURE_ACCUMULATED_ENERGY BIT ( 7 )
+
 typedef struct
 {
     uint32_t feat_blsc;
@@ -40,12 +45,22 @@ typedef struct
 
 // 3.58 Cycling Power Measurement (GATT Specification Supplement
 // 3.2 Cycling Power Measurement (Cycling Power Service Specification)
-typedef struct
+#define BLE_CPS_ACCUMULATED_TORQUE_FLAGS_FIELD BIT ( 2 )
+#define BLE_CPS_TORQUE_SOURCE_CRANK_FLAG BIT ( 3 )
+#define BLE_CPS_WHEEL_FLAGS_FIELD BIT ( 4 )
+#define BLE_CPS_CRANK_FLAGS_FIELD BIT ( 5 )
+#define BLE_CPS_ACCUMULATED_ENERGY_FLAGS_FIELD BIT ( 11 )
+
+typedef struct __attribute__ ( ( __packed__ ) )
 {
     uint16_t flags;
     int16_t InstantaneousPower;  // Watts
+    uint16_t accTorque_32;       // 1/32 Nm
+    uint32_t wheelRevs_cnt;
+    uint16_t lastWheel_2048;
+    uint16_t totalRevs_cnt;
+    uint16_t lastCrank_1024;
+    uint16_t accEnergy_kj;
 } ble_cps_measurement_data_t;
 
-int bt_cps_notify ( bike_data_t bikeData );
-
 #endif  // CPS_H
\ No newline at end of file
@@ -28,6 +28,7 @@
 #define BLE_UUID_CSCS_MEASUREMENT_CHAR BT_UUID_DECLARE_16 ( 0x2A5B )
 
 // 3.2
+#define BLE_CSCS_FEATURE_WHEEL_REV BIT ( 0 )
 #define BLE_CSCS_FEATURE_CRANK_REV BIT ( 1 )
 
 typedef struct __attribute__ ( ( __packed__ ) )
@@ -36,15 +37,16 @@ typedef struct __attribute__ ( ( __packed__ ) )
 } ble_cscs_features_t;
 
 // 3.1
+#define BLE_CSCS_WHEEL_FLAGS_FIELD BIT ( 0 )
 #define BLE_CSCS_CRANK_FLAGS_FIELD BIT ( 1 )
 
 typedef struct __attribute__ ( ( __packed__ ) )
 {
     uint8_t flags;
+    uint32_t wheelRevs_cnt;
+    uint16_t lastWheel_1024;
     uint16_t totalRevs_cnt;
     uint16_t lastCrank_1024;
 } ble_cscs_measurement_data_t;
 
-int bt_cscs_bike_notify ( bike_data_t bikeData );
-
 #endif  // CSCS_H
\ No newline at end of file
@@ -0,0 +1,60 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/timing/timing.h>
+
+// The kernel clock ticks at 32.768 kHz on the nRF52, far too coarse for a
+// few hundred instructions, so benchmarks use the timing API where there
+// is one. Returns the counter rate, safe to call more than once.
+static inline uint32_t cyclesInit()
+{
+#if defined( CONFIG_TIMING_FUNCTIONS )
+    timing_init();
+    timing_start();
+    return ( uint32_t )timing_freq_get();
+#else
+    return sys_clock_hw_cycles_per_sec();
+#endif
+}
+
+static inline uint64_t cyclesNow()
+{
+#if defined( CONFIG_TIMING_FUNCTIONS )
+    return timing_counter_get();
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+static inline uint32_t cyclesSince ( uint64_t start_cyc )
+{
+#if defined( CONFIG_TIMING_FUNCTIONS )
+    timing_t start = start_cyc;
+    timing_t end = timing_counter_get();
+    return ( uint32_t )timing_cycles_get ( &start, &end );
+#else
+    return k_cycle_get_32() - ( uint32_t )start_cyc;
+#endif
+}
+
+#endif  // CYCLES_H
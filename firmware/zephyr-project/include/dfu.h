@@ -0,0 +1,34 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DFU_H
+#define DFU_H
+
+#include <zephyr/types.h>
+
+// An upload with no chunks for this long is taken as abandoned
+#define DFU_IDLE_MS 10000
+
+// Progress is logged every this many bytes
+#define DFU_LOG_BYTES ( 32 * 1024 )
+
+// A chunk that starts this soon after the previous one finished was
+// already received while that one was written to flash
+#define DFU_QUEUED_US 500
+
+#endif  // DFU_H
@@ -0,0 +1,41 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/types.h>
+
+// Vendor diagnostics service, c0de0000-6a9b-4b1e-9c3f-2f8e5d7a1b60
+#define BT_UUID_DIAG_VAL( id )                                            \
+    BT_UUID_128_ENCODE ( 0xc0de0000 | ( id ), 0x6a9b, 0x4b1e, 0x9c3f, \
+                         0x2f8e5d7a1b60 )
+#define BT_UUID_DIAG BT_UUID_DECLARE_128 ( BT_UUID_DIAG_VAL ( 0x0001 ) )
+
+// Characteristic UUID's
+#define BLE_UUID_DIAG_TELEMETRY_CHAR \
+    BT_UUID_DECLARE_128 ( BT_UUID_DIAG_VAL ( 0x0002 ) )
+#define BLE_UUID_DIAG_TRACE_CHAR \
+    BT_UUID_DECLARE_128 ( BT_UUID_DIAG_VAL ( 0x0003 ) )
+#define BLE_UUID_DIAG_DSP_CHAR \
+    BT_UUID_DECLARE_128 ( BT_UUID_DIAG_VAL ( 0x0004 ) )
+#define BLE_UUID_DIAG_WORKOUT_CHAR \
+    BT_UUID_DECLARE_128 ( BT_UUID_DIAG_VAL ( 0x0005 ) )
+
+#endif  // DIAG_H
@@ -25,19 +25,20 @@
 
 #include "common.h"
 
-
-typedef struct
-{
-    uint16_t ms;
-    uint8_t secs;
-    uint8_t mins;
-    uint8_t hrs;
-    uint32_t last_ms;
-    bool running;
-} stopwatch_data_t;
-
+#if defined( CONFIG_DISPLAY )
 int initDisplay();
 int updateDisplay ( bike_data_t bikeData );
 void resetTime();
+#else
+static inline int initDisplay()
+{
+    return 0;
+}
+
+static inline int updateDisplay ( bike_data_t bikeData )
+{
+    return 0;
+}
+#endif
 
 #endif  // DISPLAY_H
\ No newline at end of file
@@ -0,0 +1,90 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <zephyr/types.h>
+
+#if defined( CONFIG_CMSIS_DSP )
+    #include <arm_math.h>
+#endif
+
+// Filters run at a fixed rate, samples are held between bus reads
+#define DSP_SAMPLE_MS 500
+#define DSP_PWR_AVG_TAPS ( 3000 / DSP_SAMPLE_MS )   // 3s
+#define DSP_PWR_ROLL_TAPS ( 30000 / DSP_SAMPLE_MS )  // 30s
+
+// Cadence is filtered in Q16 to keep sub-rpm resolution
+#define DSP_CADENCE_SHIFT 16
+
+// Q1.31 conversion, usable in static initializers
+#define DSP_Q31( x ) ( ( int32_t )( ( x ) * 2147483648.0 ) )
+
+// Moving window with a running sum
+typedef struct
+{
+    uint16_t *buf;
+    uint16_t len;
+    uint16_t pos;
+    uint16_t cnt;
+    uint32_t sum;
+} dsp_window_t;
+
+#define DSP_WINDOW_DEFINE( name, taps )     \
+    static uint16_t name##_buf [taps];      \
+    static dsp_window_t name = { name##_buf, taps, 0, 0, 0 }
+
+// Single biquad section, direct form I, same layout as arm_biquad_casd_df1
+typedef struct
+{
+    const int32_t *coeffs;  // { b0, b1, b2, a1, a2 }, a1/a2 negated
+    int32_t state [4];      // { x[n-1], x[n-2], y[n-1], y[n-2] }
+    int8_t postShift;
+#if defined( CONFIG_CMSIS_DSP )
+    arm_biquad_casd_df1_inst_q31 inst;  // Points at coeffs and state
+#endif
+} dsp_biquad_t;
+
+// Cycles spent per sample in each kernel, read as is by the diagnostics
+// service. CPU cycles with CONFIG_TIMING_FUNCTIONS, kernel cycles otherwise.
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    uint32_t cyc_hz;
+    uint32_t samples;
+    uint32_t window_max_cyc;  // Both power windows
+    uint32_t biquad_max_cyc;
+    uint32_t window_last_cyc;
+    uint32_t biquad_last_cyc;
+} dsp_stats_t;
+
+void dsp_window_reset ( dsp_window_t *w );
+void dsp_window_push ( dsp_window_t *w, uint16_t x );
+uint16_t dsp_window_mean ( const dsp_window_t *w );
+void dsp_biquad_init ( dsp_biquad_t *f,
+                       const int32_t *coeffs,
+                       int8_t postShift );
+int32_t dsp_biquad_q31 ( dsp_biquad_t *f, int32_t x );
+
+int dspUpdate ( uint16_t watts, uint16_t rpm, uint32_t now_ms );
+uint16_t dspGetPower3s();
+uint16_t dspGetPower30s();
+uint16_t dspGetCadence();
+dsp_stats_t dspGetStats();
+
+#endif  // DSP_H
@@ -0,0 +1,38 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ERG_H
+#define ERG_H
+
+#include <zephyr/types.h>
+
+#define ERG_MIN_WATTS 25
+#define ERG_MAX_WATTS 1000
+#define ERG_INC_WATTS 1
+
+// Cadence floor used for the inverse, avoids maxing out when slowing down
+#define ERG_MIN_RPM 40
+
+// Max magnitude change per cadence sample from a target change
+#define ERG_MAX_STEP 40
+
+void ergStart ( uint16_t watts, uint16_t res_mag );
+uint16_t ergGetTarget();
+uint16_t ergUpdate ( uint16_t rpm );
+
+#endif  // ERG_H
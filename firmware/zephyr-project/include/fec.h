@@ -39,6 +39,16 @@
 
 #define TX_SYNC 0xA4
 #define TX_CHANNEL 0x05
+#define TX_BROADCAST 0x4E
+
+// 4 Hz like an ANT+ FE channel
+#define FEC_PAGE_MS 250
+#define FEC_PAGE_LEN 8
+#define FEC_MSG_LEN ( sizeof ( tx_msg_t ) + FEC_PAGE_LEN + 1 )
+
+// Common pages go out twice in a row once every this many messages, a
+// whole number of rotations within the required 132
+#define FEC_COMMON_PAGE_INTERVAL 120
 
 typedef enum
 {
@@ -57,6 +67,12 @@ typedef enum
 } fec_page_t;
 
 #define STATIONARY_BIKE 25
+#define FEC_STATE_IN_USE 0x03
+#define FEC_CAP_DISTANCE 0x04
+#define FEC_CAP_VIRTUAL_SPEED 0x08
+#define FEC_CMD_PASS 0x00
+#define FEC_CMD_NOT_SUPPORTED 0x02
+#define FEC_REQUEST_DATA_PAGE 0x01
 typedef struct __attribute__ ( ( __packed__ ) )
 {
     uint8_t page;
@@ -197,7 +213,6 @@ typedef struct __attribute__ ( ( __packed__ ) )
 } tx_msg_t;
 
 // Functions
-void fecSetTargetsCb ( set_targets_callback_t func ); 
-void bt_fec_update ( bike_data_t data );
+void fecSetTargetsCb ( set_targets_callback_t func );
 
 #endif  // FEC_H
\ No newline at end of file
@@ -19,6 +19,7 @@
 #ifndef FTMS_H
 #define FTMS_H
 
+#include <stdbool.h>
 #include <zephyr/types.h>
 
 #include "common.h"
@@ -28,13 +29,45 @@
 #define OPCODE_RESET 0x01
 #define OPCODE_SET_INC 0x03
 #define OPCODE_SET_RES 0x04
+#define OPCODE_SET_PWR 0x05
 #define OPCODE_START 0x07
 #define OPCODE_SIM_PARAMS 0x11
 
 #define OPCODE_RESPONSE 0x80
 #define OPCODE_SUCCESS 0x01
-
-#define OPCODE_STARTED 0x04
+#define OPCODE_NOT_SUPPORTED 0x02
+#define OPCODE_INVALID_PARAM 0x03
+#define OPCODE_FAILED 0x04
+#define OPCODE_NOT_PERMITTED 0x05
+
+// Supported Inclination Range, in 0.1%
+#define FTMS_INC_MIN_TENTH_PCT -100
+#define FTMS_INC_MAX_TENTH_PCT 200
+#define FTMS_INC_STEP_TENTH_PCT 5
+
+// 4.17 Fitness Machine Status OpCodes
+#define FTMS_STATUS_STOPPED 0x02
+#define FTMS_STATUS_STARTED 0x04
+#define FTMS_STATUS_TGT_INC 0x06
+#define FTMS_STATUS_TGT_RES 0x07
+#define FTMS_STATUS_TGT_PWR 0x08
+#define FTMS_STATUS_SIM_PARAMS 0x12
+#define FTMS_STATUS_CTRL_LOST 0xFF
+
+// Stopped or Paused by the User parameter
+#define FTMS_STATUS_PARAM_STOP 0x01
+#define FTMS_STATUS_PARAM_PAUSE 0x02
+
+// Longest parameter, Indoor Bike Simulation Parameters Changed
+#define FTMS_STATUS_MAX_PARAM 6
+
+// Events waiting for the work queue, more than one control burst
+#define FTMS_STATUS_QUEUE 8
+
+// 4.10 Training Status
+#define FTMS_TRAINING_OTHER 0x00
+#define FTMS_TRAINING_WATT_CONTROL 0x0C
+#define FTMS_TRAINING_MANUAL 0x0D
 
 // Service UUID's
 #define BT_UUID_FTMS_VAL 0x1826
@@ -43,24 +76,55 @@
 // Characteristic UUID's
 #define BLE_UUID_FTMS_FEATURE_CHAR BT_UUID_DECLARE_16 ( 0x2ACC )
 #define BLE_UUID_INDOOR_BIKE_DATA_CHAR BT_UUID_DECLARE_16 ( 0x2AD2 )
+#define BLE_UUID_TRAINING_STATUS_CHAR BT_UUID_DECLARE_16 ( 0x2AD3 )
 #define BLUE_UUID_SUPPORTED_INCLINATION_RANGE_CHAR BT_UUID_DECLARE_16 ( 0x2AD5 )
 #define BLUE_UUID_SUPPORTED_RESISTANCE_RANGE_CHAR BT_UUID_DECLARE_16 ( 0x2AD6 )
+#define BLUE_UUID_SUPPORTED_POWER_RANGE_CHAR BT_UUID_DECLARE_16 ( 0x2AD8 )
 #define BLUE_UUID_FITNESS_CONTROL_POINT_CHAR BT_UUID_DECLARE_16 ( 0x2AD9 )
 #define BLE_UUID_FTMS_STATUS_CHAR BT_UUID_DECLARE_16 ( 0x2ADA )
 
 // 4.3.1.1 Fitness Machine Features Field
+#define BLE_FTMS_FEATURE_AVERAGE_SPEED_SUPPORTED_BIT BIT ( 0 )
 #define BLE_FTMS_FEATURE_CADENCE_SUPPORTED_BIT BIT ( 1 )
+#define BLE_FTMS_FEATURE_TOTAL_DISTANCE_SUPPORTED_BIT BIT ( 2 )
+#define BLE_FTMS_FEATURE_RESISTANCE_LEVEL_SUPPORTED_BIT BIT ( 7 )
+#define BLE_FTMS_FEATURE_EXPENDED_ENERGY_SUPPORTED_BIT BIT ( 9 )
+#define BLE_FTMS_FEATURE_ELAPSED_TIME_SUPPORTED_BIT BIT ( 12 )
 #define BLE_FTMS_FEATURE_POWER_MEASUREMENT_SUPPORTED_BIT BIT ( 14 )
 
 // 4.3.1.2 Target Setting Features Field
 #define BLE_FTMS_TARGET_INCLINATION_SUPPORTED_BIT BIT ( 1 )
 #define BLE_FTMS_TARGET_RESISTANCE_SUPPORTED_BIT BIT ( 2 )
+#define BLE_FTMS_TARGET_POWER_SUPPORTED_BIT BIT ( 3 )
 #define BLE_FTMS_BIKE_SIMULATION_SUPPORTED_BIT BIT ( 13 )
 
 // 3.116 Indoor Bike Data (GATT Specification Supplement)
 // 4.9.1 Characteristic Behavior (Fitness Machine Service Specification)
+#define BLE_FTMS_INDOOR_FLAGS_MORE_DATA BIT ( 0 )  // Speed absent when set
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_SPEED_PRESENT BIT ( 1 )
 #define BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_CADENCE_PRESENT BIT ( 2 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_CADENCE_PRESENT BIT ( 3 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_TOTAL_DISTANCE_PRESENT BIT ( 4 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_RESISTANCE_LEVEL_PRESENT BIT ( 5 )
 #define BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_POWER_PRESENT BIT ( 6 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_POWER_PRESENT BIT ( 7 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_EXPENDED_ENERGY_PRESENT BIT ( 8 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_HEART_RATE_PRESENT BIT ( 9 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_MET_PRESENT BIT ( 10 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_ELAPSED_TIME_PRESENT BIT ( 11 )
+#define BLE_FTMS_INDOOR_FLAGS_FIELD_REMAINING_TIME_PRESENT BIT ( 12 )
+
+// Optional Indoor Bike Data fields sent, instantaneous speed always is
+#define FTMS_BIKE_DATA_FIELDS                                    \
+    ( BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_SPEED_PRESENT          \
+      | BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_CADENCE_PRESENT \
+      | BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_CADENCE_PRESENT      \
+      | BLE_FTMS_INDOOR_FLAGS_FIELD_TOTAL_DISTANCE_PRESENT       \
+      | BLE_FTMS_INDOOR_FLAGS_FIELD_RESISTANCE_LEVEL_PRESENT     \
+      | BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_POWER_PRESENT  \
+      | BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_POWER_PRESENT        \
+      | BLE_FTMS_INDOOR_FLAGS_FIELD_EXPENDED_ENERGY_PRESENT      \
+      | BLE_FTMS_INDOOR_FLAGS_FIELD_ELAPSED_TIME_PRESENT )
 
 //  Read feature callback
 // 4.3 Fitness Machine Feature
@@ -86,6 +150,14 @@ typedef struct __attribute__ ( ( __packed__ ) )
     uint16_t inc_tenth_pct;
 } ble_ftms_inclination_range_data_t;
 
+//  Read power range callback
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    int16_t min_watts;
+    int16_t max_watts;
+    uint16_t inc_watts;
+} ble_ftms_power_range_data_t;
+
 // 4.16 Fitness Machine Control Point
 typedef struct __attribute__ ( ( __packed__ ) )
 {
@@ -96,7 +168,7 @@ typedef struct __attribute__ ( ( __packed__ ) )
 // 4.16.2.18 Set Indoor Bike Simulation Parameters Procedure
 typedef struct __attribute__ ( ( __packed__ ) )
 {
-    int16_t wind_mps;
+    int16_t wind_mps;  // 0.001 m/s
     int16_t grade_hundredths_pct;
     uint8_t Crr;  // 0.0001
     uint8_t Cw;   // 0.01
@@ -111,25 +183,28 @@ typedef struct __attribute__ ( ( __packed__ ) )
     uint8_t param [];
 } ctrl_point_resp_t;
 
-// Indoor bike data
+// 4.10 Training Status, no status string
 typedef struct __attribute__ ( ( __packed__ ) )
 {
-    uint16_t flags;
-    uint16_t InstantaneousSpeed;    // 1/100 of kph
-    uint16_t InstantaneousCadence;  // 1/2 of rpm
-    int16_t InstantaneousPower;     // watts
-} ble_ftms_indoor_bike_data_t;
-
-// 4.17 Fitness Machine Status
-typedef struct ftms_status
+    uint8_t flags;
+    uint8_t status;
+} ftms_training_t;
+
+// 4.17 Fitness Machine Status, the parameter length depends on the op
+typedef struct __attribute__ ( ( __packed__ ) )
 {
     uint8_t op;
-    uint8_t param [];
+    uint8_t param [FTMS_STATUS_MAX_PARAM];
 } ftms_status_t;
 
+// Indoor bike data rate, the publisher skips unchanged payloads
+#define FTMS_DATA_PERIOD_MS 250
+
 // Functions
-void ftmsSetTargetsCb ( set_targets_callback_t func ); 
-int bt_ftms_bike_notify ( bike_data_t bikeData );
-int bt_ftms_status_notify();
+void ftmsSetTargetsCb ( set_targets_callback_t func );
+void ftmsStatusTargets ( const bike_tgts_t tgts );
+void ftmsStatusUser ( bool started );
+void ftmsRevokeControl();
+void ftmsTrainingStatus ( uint8_t status );
 
 #endif  // FTMS_H
\ No newline at end of file
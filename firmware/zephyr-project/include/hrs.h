@@ -0,0 +1,62 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HRS_H
+#define HRS_H
+
+#include <stdbool.h>
+#include <zephyr/types.h>
+
+// Low duty scan, a 30 ms window every 1.28 s (0.625 ms units)
+#define HRS_SCAN_INTERVAL 0x0800
+#define HRS_SCAN_WINDOW 0x0030
+
+// Straps send once a second, long intervals leave the radio to the apps
+#define HRS_CONN_INT 192  // 240 ms, a multiple of the peripheral intervals
+#define HRS_CONN_LATENCY 0
+#define HRS_CONN_TIMEOUT 400  // 4 s
+
+#define HRS_RETRY_MS 1000
+
+#if defined( CONFIG_BT_CENTRAL )
+void hrsStart();
+void hrsPause ( bool pause );
+uint8_t hrsGetBpm();
+uint32_t hrsGetBpmMs();
+#else
+static inline void hrsStart()
+{
+}
+
+static inline void hrsPause ( bool pause )
+{
+}
+
+static inline uint8_t hrsGetBpm()
+{
+    return 0;
+}
+
+static inline uint32_t hrsGetBpmMs()
+{
+    return 0;
+}
+#endif
+
+#endif  // HRS_H
@@ -0,0 +1,60 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdbool.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/types.h>
+
+#include "common.h"
+
+// Riding, short intervals for control latency (1.25 ms units)
+#define LINK_ACTIVE_INT_MIN 12  // 15 ms
+#define LINK_ACTIVE_INT_MAX 24  // 30 ms
+#define LINK_ACTIVE_LATENCY 0
+#define LINK_ACTIVE_TIMEOUT 400  // 4 s, 10 ms units
+
+// Idle, long intervals and peripheral latency to save radio power
+#define LINK_IDLE_INT_MIN 160  // 200 ms
+#define LINK_IDLE_INT_MAX 320  // 400 ms
+#define LINK_IDLE_LATENCY 4
+#define LINK_IDLE_TIMEOUT 600  // 6 s
+
+// Image upload, as many connection events as the central allows
+#define LINK_DFU_INT_MIN 6   // 7.5 ms
+#define LINK_DFU_INT_MAX 12  // 15 ms
+#define LINK_DFU_LATENCY 0
+#define LINK_DFU_TIMEOUT 400
+
+// No cadence for this long relaxes the link
+#define LINK_IDLE_MS 30000
+
+typedef enum
+{
+    LINK_IDLE,
+    LINK_ACTIVE,
+    LINK_DFU
+} linkProfile_t;
+
+void linkUpdate ( const bike_data_t *data, uint32_t now_ms );
+void linkSetDfu ( bool active );
+bool linkIsPeripheral ( struct bt_conn *conn );
+
+#endif  // LINK_H
@@ -0,0 +1,39 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POWER_MODEL_H
+#define POWER_MODEL_H
+
+#include <zephyr/types.h>
+
+// Resistance magnitude (RES_NODE counts) to display level mapping
+#define RES_MIN_MAG 15
+#define RES_MAX_MAG 190
+#define RES_MAG_PER_LVL 5
+#define RES_MIN_LVL 1
+#define RES_MAX_LVL 22
+
+// Precomputed table resolution
+#define PM_RPM_STEP 5
+#define PM_RPM_BINS 41  // 0..200 rpm
+
+uint16_t calc_watts_physics_params ( double rpm_crank, int level );
+uint16_t pmWatts ( uint16_t rpm, uint16_t res_mag );
+uint16_t pmResForWatts ( uint16_t rpm, uint16_t watts );
+
+#endif  // POWER_MODEL_H
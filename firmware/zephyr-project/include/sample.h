@@ -0,0 +1,48 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <zephyr/types.h>
+
+#include "common.h"
+
+// What a reading turns into once it is older than its limit
+typedef enum
+{
+    SAMPLE_HOLD,    // Last value stays
+    SAMPLE_DECAY,   // Reads as zero, so rates and totals stop
+    SAMPLE_INVALID  // Last value stays in totals, published as missing
+} samplePolicy_t;
+
+// Cadence is polled every cycle, three missed replies make it stale. Test
+// builds can pick another policy.
+#define SAMPLE_RPM_MAX_AGE_MS 1500
+#ifndef SAMPLE_RPM_POLICY
+#define SAMPLE_RPM_POLICY SAMPLE_DECAY
+#endif
+
+// Straps send about once a second
+#define SAMPLE_HR_MAX_AGE_MS 5000
+#define SAMPLE_HR_POLICY SAMPLE_DECAY
+
+void sampleApply ( bike_data_t *data );
+
+#endif  // SAMPLE_H
@@ -0,0 +1,83 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <zephyr/types.h>
+
+// Rider and bike
+#define SIM_MASS_KG 85.0f
+#define SIM_GRAVITY 9.81f
+#define SIM_DRIVETRAIN_ETA 0.97f
+
+// Defaults used until the app sends its own (FTMS units)
+#define SIM_DEFAULT_CRR 40  // 0.0001
+#define SIM_DEFAULT_CW 51   // 0.01 kg/m
+
+// Virtual drivetrain, chainring x cog from easiest to hardest
+#define SIM_WHEEL_MM 2096
+#define SIM_GEAR_TABLE( G ) \
+    G ( 34, 32 )            \
+    G ( 34, 28 )            \
+    G ( 34, 25 )            \
+    G ( 34, 22 )            \
+    G ( 34, 19 )            \
+    G ( 34, 17 )            \
+    G ( 34, 15 )            \
+    G ( 50, 19 )            \
+    G ( 50, 17 )            \
+    G ( 50, 15 )            \
+    G ( 50, 14 )            \
+    G ( 50, 13 )            \
+    G ( 50, 12 )            \
+    G ( 50, 11 )
+#define SIM_DEFAULT_GEAR 5  // 34x17
+
+// Power curve over wheel speed, rebuilt when parameters change
+#define SIM_SPEED_STEP_MMPS 250
+#define SIM_SPEED_BINS 81  // 0 - 20 m/s
+
+// Physics runs on the same units FTMS uses
+typedef struct
+{
+    int16_t wind_mmps;   // 0.001 m/s, headwind positive
+    int16_t grade;       // 0.01%
+    uint8_t crr;         // 0.0001
+    uint8_t cw;          // 0.01 kg/m
+} sim_params_t;
+
+// Road load at the wheel, P = ( f_const + cw * ( v + wind )^2 ) * v
+typedef struct
+{
+    float f_const;  // Gravity + rolling, N
+    float cw;       // kg/m
+    float wind;     // m/s
+} sim_forces_t;
+
+void simSetParams ( int16_t wind_mmps, uint8_t crr, uint8_t cw );
+void simSetGrade ( int16_t grade );
+sim_params_t simGetParams();
+sim_forces_t simGetForces();
+void simShift ( int8_t dir );
+uint8_t simGetGear();
+uint16_t simWheelSpeed ( uint16_t rpm );
+float simRequiredWatts ( float speed_mps );
+uint16_t simUpdate ( uint16_t rpm );
+
+#endif  // SIM_H
@@ -0,0 +1,36 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPEED_H
+#define SPEED_H
+
+#include <zephyr/types.h>
+
+#include "common.h"
+
+// Newton solve is warm started and bounded, so its cost is fixed
+#define SPEED_MAX_ITERS 6
+#define SPEED_TOL_MPS 0.005f
+#define SPEED_MAX_MPS 30.0f
+
+// Longest gap integrated between two samples, guards against loop stalls
+#define SPEED_MAX_DT_MS 2000
+
+void speedUpdate ( bike_data_t *data, uint32_t now_ms );
+
+#endif  // SPEED_H
@@ -0,0 +1,54 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <zephyr/types.h>
+
+// LE dynamic range, fixed so tuning tools can connect without discovery
+#define STREAM_PSM 0x0081
+
+// One K-frame per SDU with 251 byte ACL buffers
+#define STREAM_MTU 243
+#define STREAM_BATCHES 4
+
+// Partial batches go out after this long so a slow bus still streams
+#define STREAM_FLUSH_MS 250
+
+// One bus transaction
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    uint16_t dt_ms;  // Since the batch started, filled in by the stream
+    uint8_t node;
+    uint8_t func;
+    uint16_t value;   // Value written or read back
+    uint16_t rtt_us;  // Bus round trip of the last try, 0xFFFF if longer
+    uint8_t tries;    // 0 when every try failed
+} stream_rec_t;
+
+// Starts every batch, gaps in seq are dropped batches
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    uint16_t seq;
+    uint32_t t_ms;
+} stream_batch_t;
+
+void streamRecord ( stream_rec_t rec );
+
+#endif  // STREAM_H
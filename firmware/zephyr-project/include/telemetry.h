@@ -0,0 +1,119 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/types.h>
+
+#include "common.h"
+
+// Publisher wakes at least this often for periodic channels
+#define TELEMETRY_TICK_MS 250
+
+// Unchanged payloads are still resent this often so clients see a live link
+#define TELEMETRY_REFRESH_MS 2000
+
+// Payloads are encoded for each connection's ATT MTU, anything bigger than
+// the default has to be split by the channel
+#define TELEMETRY_MIN_LEN 20  // Default ATT MTU - 3
+#define TELEMETRY_MAX_LEN 32
+#define TELEMETRY_MAX_CHANS 6
+
+// Notifications allowed in the controller per connection, anything newer
+// waits in a single pending slot per channel
+#define TELEMETRY_MAX_IN_FLIGHT 2
+
+// Channel period that sends once per new sample, or once per event for
+// channels with an event counter
+#define TELEMETRY_ON_SAMPLE 0
+
+// Encodes a payload of at most len bytes from the snapshot, returns its
+// length or 0 when there is nothing to send at this size
+typedef size_t ( *telemetry_encode_t ) ( const bike_data_t *data,
+                                         uint8_t *buf,
+                                         size_t len );
+
+// Returns a counter that changes whenever the channel has news
+typedef uint32_t ( *telemetry_event_t ) ( const bike_data_t *data );
+
+// Per connection state of a channel
+typedef struct
+{
+    uint32_t due_ms;
+    uint32_t sent_ms;
+    uint32_t seq;
+    uint32_t sent;
+    uint8_t len;
+    uint8_t last [TELEMETRY_MAX_LEN];
+    bool pending;
+    uint8_t pend_len;
+    uint8_t pend [TELEMETRY_MAX_LEN];
+} telemetry_sub_t;
+
+typedef struct
+{
+    const char *name;
+    telemetry_encode_t encode;
+    telemetry_event_t event;  // Optional, replaces the sample count
+    uint16_t period_ms;
+
+    // Owned by the publisher
+    const struct bt_gatt_attr *attr;
+    telemetry_sub_t subs [CONFIG_BT_MAX_CONN];
+} telemetry_chan_t;
+
+// Read as is by the diagnostics service. CPU cycles with
+// CONFIG_TIMING_FUNCTIONS, kernel cycles otherwise.
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    uint32_t cyc_hz;
+    uint32_t last_cyc;  // Cycles spent in the last publisher run
+    uint32_t max_cyc;
+    uint32_t sent;
+    uint32_t completed;
+    uint32_t skipped;    // Unchanged payloads not sent
+    uint32_t coalesced;  // Pending payloads replaced by newer ones
+    uint32_t dropped;    // Failed sends and pending payloads thrown away
+    uint16_t lat_last_ms;  // Submit to completion
+    uint16_t lat_avg_ms;
+    uint16_t lat_max_ms;
+    uint16_t first_new_ms;  // Connection to first notification, by peer
+    uint16_t first_bonded_ms;
+    uint16_t age_last_ms;  // Cadence reading behind a publish, by run
+    uint16_t age_avg_ms;
+    uint16_t age_max_ms;
+    uint32_t stale;  // Runs that published a stale reading
+} telemetry_stats_t;
+
+int telemetryRegister ( telemetry_chan_t *chan,
+                        const struct bt_gatt_service_static *svc,
+                        const struct bt_uuid *uuid );
+void telemetryPublish ( const bike_data_t *data );
+void telemetryPublishCrank ( uint32_t revs, uint32_t evt_1024 );
+bike_data_t telemetryGetSnapshot();
+void telemetryPause ( bool pause );
+bool telemetryPaused();
+telemetry_stats_t telemetryGetStats();
+
+#endif  // TELEMETRY_H
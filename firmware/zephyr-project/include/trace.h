@@ -0,0 +1,62 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <zephyr/types.h>
+
+// Points a control command passes on its way to the bike
+typedef enum
+{
+    TRACE_RX,        // Written by the app
+    TRACE_APPLIED,   // Targets handed to the bike
+    TRACE_QUEUED,    // First bus attempt started
+    TRACE_LAST_TRY,  // Attempt that got through started
+    TRACE_ACKED,     // Frame sent and the reply parsed
+    TRACE_MARKS
+} traceMark_t;
+
+// Intervals between consecutive marks, then the whole trip
+#define TRACE_STAGES TRACE_MARKS
+#define TRACE_TOTAL ( TRACE_MARKS - 1 )
+
+// Commands followed at once, older ones are forgotten
+#define TRACE_SLOTS 4
+
+// Log2 bins from 250 us, the last one holds everything from 4.096 s
+#define TRACE_BINS 16
+#define TRACE_BIN0_US 250
+
+// Read as is by the diagnostics service, hist [TRACE_TOTAL] is end to end
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    uint32_t started;
+    uint32_t completed;
+    uint32_t dropped;  // Superseded, failed on the bus or never sent
+    uint32_t last_us [TRACE_STAGES];
+    uint16_t hist [TRACE_STAGES][TRACE_BINS];
+} trace_stats_t;
+
+uint16_t traceStart();
+void traceMark ( uint16_t id, traceMark_t mark );
+void traceDrop ( uint16_t id );
+trace_stats_t traceGetStats();
+
+#endif  // TRACE_H
@@ -0,0 +1,69 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKOUT_H
+#define WORKOUT_H
+
+#include <stdbool.h>
+#include <zephyr/types.h>
+
+// Segment end times are cumulative, in seconds from the start
+#define WORKOUT_MIN( m ) ( ( m ) * 60 )
+#define WORKOUT_ERG( end_s, watts ) { end_s, SEG_ERG, watts }
+#define WORKOUT_GRADE( end_s, grade ) { end_s, SEG_GRADE, grade }
+
+// Extra lead on top of the measured incline travel time
+#define WORKOUT_LEAD_MS 1000
+
+// Longest workout that can be uploaded and stored in flash
+#define WORKOUT_MAX_SEGS 32
+
+typedef enum
+{
+    SEG_ERG,    // Target in W
+    SEG_GRADE,  // Target in 0.01%
+} workoutSegType_t;
+
+typedef struct
+{
+    uint32_t end_s;
+    workoutSegType_t type;
+    int16_t target;
+} workout_seg_t;
+
+typedef struct
+{
+    const char *name;
+    const workout_seg_t *segs;
+    uint8_t cnt;
+} workout_t;
+
+// Upload record, little endian, also the layout kept in flash
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    uint32_t end_s;
+    uint8_t type;
+    int16_t target;
+} workout_rec_t;
+
+int workoutLoad ( const workout_rec_t *recs, uint8_t cnt );
+void workoutToggle();
+bool workoutActive();
+void workoutUpdate ( uint32_t now_ms );
+
+#endif  // WORKOUT_H
@@ -0,0 +1,198 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "advertising.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <zephyr/bluetooth/addr.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "cps.h"
+#include "ftms.h"
+#include "link.h"
+
+LOG_MODULE_REGISTER ( adv );
+
+static const struct bt_data ad []
+    = { BT_DATA_BYTES ( BT_DATA_GAP_APPEARANCE,
+                        ( BT_DEVICE_CYCLING_APPEARANCE >> 0 ) & 0xff,
+                        ( BT_DEVICE_CYCLING_APPEARANCE >> 8 ) & 0xff ),
+        BT_DATA_BYTES ( BT_DATA_FLAGS,
+                        ( BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR ) ),
+        BT_DATA_BYTES ( BT_DATA_UUID16_ALL,
+                        BT_UUID_16_ENCODE ( BT_UUID_CPS_VAL ),
+                        BT_UUID_16_ENCODE ( BT_UUID_CSC_VAL ),
+                        BT_UUID_16_ENCODE ( BT_UUID_FTMS_VAL ) ),
+        BT_DATA ( BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN ) };
+
+static const struct bt_data sd [] = {
+    BT_DATA_BYTES ( BT_DATA_UUID128_ALL,
+                    0x84,
+                    0xaa,
+                    0x60,
+                    0x74,
+                    0x52,
+                    0x8a,
+                    0x8b,
+                    0x86,
+                    0xd3,
+                    0x4c,
+                    0xb7,
+                    0x1d,
+                    0x1d,
+                    0xdc,
+                    0x53,
+                    0x8d ),
+};
+
+// Restarts are handled here, so the stack never resumes on its own
+static const struct bt_le_adv_param *FAST_PARAM
+    = BT_LE_ADV_PARAM ( BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_ONE_TIME,
+                        BT_GAP_ADV_FAST_INT_MIN_2,
+                        BT_GAP_ADV_FAST_INT_MAX_2,
+                        NULL );
+static const struct bt_le_adv_param *SLOW_PARAM
+    = BT_LE_ADV_PARAM ( BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_ONE_TIME,
+                        BT_GAP_ADV_SLOW_INT_MIN,
+                        BT_GAP_ADV_SLOW_INT_MAX,
+                        NULL );
+
+static void adv_work_handler ( struct k_work *work );
+K_WORK_DELAYABLE_DEFINE ( adv_work, adv_work_handler );
+
+// Only touched from the bluetooth thread and the system work queue
+static advMode_t mode = ADV_STOPPED;
+static advMode_t next = ADV_FAST;
+static uint8_t conn_cnt = 0;
+static bt_addr_le_t peer;
+
+static const char *mode_str ( advMode_t m )
+{
+    switch ( m ) {
+        case ADV_DIRECTED:
+            return "directed";
+        case ADV_FAST:
+            return "fast";
+        case ADV_SLOW:
+            return "slow";
+        default:
+            return "stopped";
+    }
+}
+
+static int start_mode ( advMode_t m )
+{
+    switch ( m ) {
+        case ADV_DIRECTED:
+            return bt_le_adv_start (
+                BT_LE_ADV_CONN_DIR ( &peer ), NULL, 0, NULL, 0 );
+        case ADV_FAST:
+            return bt_le_adv_start (
+                FAST_PARAM, ad, ARRAY_SIZE ( ad ), sd, ARRAY_SIZE ( sd ) );
+        case ADV_SLOW:
+            return bt_le_adv_start (
+                SLOW_PARAM, ad, ARRAY_SIZE ( ad ), sd, ARRAY_SIZE ( sd ) );
+        default:
+            return 0;
+    }
+}
+
+static void adv_work_handler ( struct k_work *work )
+{
+    bt_le_adv_stop();
+    if ( conn_cnt >= ADV_MAX_CONN ) {
+        next = ADV_STOPPED;
+    }
+
+    int err = start_mode ( next );
+    if ( err ) {
+        // The disconnected connection may not be freed yet
+        LOG_WRN ( "Advertising (%s) failed to start (err %d)",
+                  mode_str ( next ),
+                  err );
+        mode = ADV_STOPPED;
+        k_work_reschedule ( &adv_work, K_MSEC ( ADV_RETRY_MS ) );
+        return;
+    }
+    mode = next;
+    LOG_INF ( "Advertising: %s", mode_str ( mode ) );
+
+    // Fast advertising drops to slow once the window runs out
+    if ( mode == ADV_FAST ) {
+        next = ADV_SLOW;
+        k_work_reschedule ( &adv_work, K_MSEC ( ADV_FAST_MS ) );
+    }
+}
+
+static void request ( advMode_t m )
+{
+    next = m;
+    k_work_reschedule ( &adv_work, K_NO_WAIT );
+}
+
+void advStart()
+{
+    request ( ADV_FAST );
+}
+
+static void connected ( struct bt_conn *conn, uint8_t err )
+{
+    if ( !linkIsPeripheral ( conn ) ) {
+        return;
+    } else if ( err == BT_HCI_ERR_ADV_TIMEOUT ) {
+        // High duty directed only lasts 1.28 s
+        LOG_INF ( "Directed advertising timed out" );
+        request ( ADV_FAST );
+        return;
+    } else if ( err ) {
+        request ( ADV_FAST );
+        return;
+    }
+
+    // Keep a slot open for another central at low duty
+    conn_cnt++;
+    request ( ADV_SLOW );
+}
+
+static void disconnected ( struct bt_conn *conn, uint8_t reason )
+{
+    if ( !linkIsPeripheral ( conn ) ) {
+        return;
+    }
+    if ( conn_cnt ) {
+        conn_cnt--;
+    }
+
+    // Bonded centrals usually want straight back in
+    const bt_addr_le_t *dst = bt_conn_get_dst ( conn );
+    if ( bt_addr_le_is_bonded ( BT_ID_DEFAULT, dst ) ) {
+        bt_addr_le_copy ( &peer, dst );
+        request ( ADV_DIRECTED );
+    } else {
+        request ( ADV_FAST );
+    }
+}
+
+BT_CONN_CB_DEFINE ( adv_conn_callbacks )
+    = { .connected = connected, .disconnected = disconnected };
@@ -25,10 +25,19 @@
 #include <zephyr/kernel.h>
 
 #include "asciiModbus.h"
+#include "erg.h"
+#include "ftms.h"
+#include "powerModel.h"
+#include "sim.h"
+#include "stream.h"
+#include "trace.h"
 
 LOG_MODULE_REGISTER ( bike );
 static send_msg_callback_t sendMsgCbFunc = NULL;
 
+// Given on a shift so the new resistance goes out without waiting a cycle
+K_SEM_DEFINE ( shift_sem, 0, 1 );
+
 // Global variables
 static cmd_msg_data_t CFG_CMD_1 = { RES_NODE, WRITE_HOLD, 0x0007, 0x000F };
 static cmd_msg_data_t CFG_CMD_2 = { RES_NODE, WRITE_HOLD, 0x0008, 0x00BE };
@@ -45,21 +54,55 @@ static cmd_msg_data_t ZERO_RPM
 
 // Control parameters
 static uint16_t act_rpm = 0;
+static uint32_t rpm_ms = 0;  // Uptime of the last cadence reply
 static uint16_t act_inc = INIT_INC;
 static uint16_t disp_res = 1;
 static bool firstRead = false;
+static uint16_t inc_ms_per_cnt = INC_DEFAULT_MS_PER_CNT;
+static bikeMode_t mode = MODE_MANUAL;
+
+// Latency traces waiting for their bus write, set from the work queue
+static atomic_t inc_trace = ATOMIC_INIT ( 0 );
+static atomic_t res_trace = ATOMIC_INIT ( 0 );
 
 void setSendMsgCb ( send_msg_callback_t func )
 {
     sendMsgCbFunc = func;
 }
 
-void sendWithRetries ( cmd_msg_data_t cmd, uint16_t retries, int32_t delay_ms )
+// Every bus transaction goes to the tuning stream, reads with their reply
+static void stream_bus ( cmd_msg_data_t cmd, uint32_t rtt_cyc, uint8_t tries )
+{
+    stream_rec_t rec = {
+        .node = cmd.nodeId,
+        .func = cmd.funcCode,
+        .value = cmd.value,
+        .tries = tries,
+    };
+    const uint32_t rtt_us = k_cyc_to_us_floor32 ( rtt_cyc );
+    rec.rtt_us = rtt_us > UINT16_MAX ? UINT16_MAX : rtt_us;
+    if ( tries && ( cmd.funcCode == READ_MULTI_HOLD ) ) {
+        rec.value = ( cmd.nodeId == RPM_NODE ) ? act_rpm : act_inc;
+    }
+    streamRecord ( rec );
+}
+
+static void send_retries ( cmd_msg_data_t cmd,
+                           uint16_t retries,
+                           int32_t delay_ms,
+                           uint16_t trace )
 {
     int res;
+    uint32_t rtt_cyc = 0;
+    traceMark ( trace, TRACE_QUEUED );
     for ( int i = 0; i < retries + 1; i++ ) {
+        traceMark ( trace, TRACE_LAST_TRY );
+        const uint32_t start_cyc = k_cycle_get_32();
         res = sendMsgCbFunc ( cmd );
+        rtt_cyc = k_cycle_get_32() - start_cyc;
         if ( !res ) {
+            traceMark ( trace, TRACE_ACKED );
+            stream_bus ( cmd, rtt_cyc, i + 1 );
             return;
         } else {
             LOG_ERR ( "Failed to send on attempt %d out of %u.  Returned: %d",
@@ -69,6 +112,28 @@ void sendWithRetries ( cmd_msg_data_t cmd, uint16_t retries, int32_t delay_ms )
         }
         k_msleep ( delay_ms );
     }
+    traceDrop ( trace );
+    stream_bus ( cmd, rtt_cyc, 0 );
+}
+
+void sendWithRetries ( cmd_msg_data_t cmd, uint16_t retries, int32_t delay_ms )
+{
+    send_retries ( cmd, retries, delay_ms, 0 );
+}
+
+// A trace both nodes hold completes on whichever node changes, so one
+// node declining only drops it once the other no longer holds it
+static void release_trace ( uint16_t trace, atomic_t *other )
+{
+    if ( trace && ( ( uint16_t )atomic_get ( other ) != trace ) ) {
+        traceDrop ( trace );
+    }
+}
+
+// A newer command for the same node supersedes the pending one
+static void hold_trace ( atomic_t *slot, atomic_t *other, uint16_t trace )
+{
+    release_trace ( ( uint16_t )atomic_set ( slot, trace ), other );
 }
 
 // Evalute user inputs
@@ -84,43 +149,82 @@ buttonStatus_t evaluateButton ( int up, int down )
 
 static uint16_t calc_res()
 {
-    int16_t res = 15;
+    int16_t res = RES_MIN_MAG;
 
     // +1 display resistance is worth 5 counts
-    res += 5 * ( disp_res - 1 );
+    res += RES_MAG_PER_LVL * ( disp_res - 1 );
 
     // 1% grade is worth 4 counts
     res += 4 * ( ( act_inc - 20 ) / 2 );
     
     // Clip
-    if ( res < 15 ) {
-        return 15;
-    } else if ( res > 190 ) {
-        return 190;
+    if ( res < RES_MIN_MAG ) {
+        return RES_MIN_MAG;
+    } else if ( res > RES_MAX_MAG ) {
+        return RES_MAX_MAG;
     }
     return res;
 }
 
+// Apps see mode changes as the training status
+static void set_mode ( bikeMode_t m )
+{
+    static const uint8_t TRAINING [] = {
+        [MODE_MANUAL] = FTMS_TRAINING_MANUAL,
+        [MODE_ERG] = FTMS_TRAINING_WATT_CONTROL,
+        [MODE_SIM] = FTMS_TRAINING_OTHER,
+    };
+    mode = m;
+    ftmsTrainingStatus ( TRAINING [m] );
+}
+
 void adjustIncline ( buttonStatus_t adj )
 {
+    bike_tgts_t tgts = BIKE_TGTS_NONE;
     if ( ( adj == INCREASE ) && ( SET_INC.value < 60 ) ) {
         SET_INC.value++;
         LOG_INF ( "Increasing incline to: %d", SET_INC.value );
     } else if ( ( adj == DECREASE ) && ( SET_INC.value > 0 ) ) {
         SET_INC.value--;
         LOG_INF ( "Decreasing incline to: %d", SET_INC.value );
+    } else {
+        return;
     }
+    tgts.incline = SET_INC.value * 50 - 1000;  // Inverse of grade_to_inc
+    ftmsStatusTargets ( tgts );
 }
 
 void adjustResistance ( buttonStatus_t adj )
 {
-    if ( ( adj == INCREASE ) && ( disp_res < 22 ) ) {
+    // Manual adjustment always takes back control from ERG, and from the
+    // app steering it
+    if ( ( adj != NOTHING ) && ( mode == MODE_ERG ) ) {
+        LOG_INF ( "Leaving ERG mode" );
+        set_mode ( MODE_MANUAL );
+        ftmsRevokeControl();
+    }
+    if ( mode == MODE_SIM ) {
+        // Buttons become a virtual shifter
+        if ( adj == INCREASE ) {
+            simShift ( 1 );
+        } else if ( adj == DECREASE ) {
+            simShift ( -1 );
+        }
+    } else if ( ( adj == INCREASE ) && ( disp_res < 22 ) ) {
         disp_res++;
         LOG_INF ( "Increasing resistance to: %d", disp_res );
     } else if ( ( adj == DECREASE ) && ( disp_res > 1 ) ) {
         disp_res--;
         LOG_INF ( "Decreasing resistance to: %d", disp_res );
     }
+    if ( ( adj != NOTHING ) && ( mode == MODE_MANUAL ) ) {
+        bike_tgts_t tgts = BIKE_TGTS_NONE;
+        tgts.resistance = disp_res;
+        ftmsStatusTargets ( tgts );
+    }
+    if ( adj != NOTHING ) {
+        k_sem_give ( &shift_sem );
+    }
 }
 
 static void setIncline ( uint16_t tgt )
@@ -136,32 +240,63 @@ static void setIncline ( uint16_t tgt )
 static void setResistance ( uint16_t tgt )
 {
     LOG_INF ( "Setting resistance to: %u", tgt );
-    if ( tgt > 22 ) {
-        SET_INC.value = 22;
-    } else if ( tgt <= 1 ) {
-        SET_INC.value = 1;
+    if ( tgt > RES_MAX_LVL ) {
+        disp_res = RES_MAX_LVL;
+    } else if ( tgt <= RES_MIN_LVL ) {
+        disp_res = RES_MIN_LVL;
     } else {
-        SET_INC.value = tgt;
+        disp_res = tgt;
     }
 }
 
+// Grade in 0.01% to incline counts, 0.5% per count from -10%
+static uint16_t grade_to_inc ( int16_t grade )
+{
+    if ( grade >= 2000 ) {
+        return 60;
+    } else if ( grade <= -1000 ) {
+        return 0;
+    }
+    uint16_t roundUp = ( grade + 1000 ) % 50 > 25 ? 1 : 0;
+    return ( grade + 1000 ) / 50 + roundUp;
+}
+
+// Move the incline motor without touching the simulated grade
+void prepositionIncline ( int16_t grade )
+{
+    LOG_INF ( "Pre-positioning incline for grade: %d", grade );
+    setIncline ( grade_to_inc ( grade ) );
+}
+
+// Expected time to reach a grade from the current position
+uint32_t inclineTravelMs ( int16_t grade )
+{
+    const int32_t cnts = ( int32_t )grade_to_inc ( grade ) - act_inc;
+    return ( cnts < 0 ? -cnts : cnts ) * inc_ms_per_cnt;
+}
+
 // Update bike targets
 void updateBikeTgts ( const bike_tgts_t tgts )
 {
+    traceMark ( tgts.trace, TRACE_APPLIED );
+
+    // Simulation parameters
+    const bool sim = ( tgts.wind != 0x7FFF ) || ( tgts.crr != 0xFF )
+                     || ( tgts.cw != 0xFF );
+    if ( sim ) {
+        simSetParams ( tgts.wind, tgts.crr, tgts.cw );
+        set_mode ( MODE_SIM );
+    }
+
     // Incline
     if ( tgts.incline != 0x7FFF ) {
-        if ( tgts.incline >= 2000 ) {
-            setIncline ( 60 );
-        } else if ( tgts.incline <= -1000 ) {
-            setIncline ( 0 );
-        } else {
-            uint16_t roundUp = ( tgts.incline + 1000 ) % 50 > 25 ? 1 : 0;
-            setIncline ( ( tgts.incline + 1000 ) / 50 + roundUp );
-        }
+        simSetGrade ( tgts.incline );
+        setIncline ( grade_to_inc ( tgts.incline ) );
     }
 
     // Resistance
     if ( tgts.resistance != 0xFF ) {
+        set_mode ( MODE_MANUAL );
         if ( tgts.resistance >= 200 ) {
             setResistance ( 22 );
         } else if ( tgts.resistance == 0 ) {
@@ -171,6 +306,34 @@ void updateBikeTgts ( const bike_tgts_t tgts )
             setResistance ( 1 + ( tgts.resistance * 21 ) / 200 + roundUp );
         }
     }
+
+    // Power
+    if ( tgts.power != 0xFFFF ) {
+        ergStart ( tgts.power, SET_RES.value );
+        set_mode ( MODE_ERG );
+    }
+
+    // Incline goes to its own node, everything else ends up as resistance
+    if ( tgts.incline != 0x7FFF ) {
+        hold_trace ( &inc_trace, &res_trace, tgts.trace );
+    }
+    if ( sim || ( tgts.resistance != 0xFF ) || ( tgts.power != 0xFFFF ) ) {
+        hold_trace ( &res_trace, &inc_trace, tgts.trace );
+    }
+
+    // Report what was applied, sim fields left out keep their values
+    bike_tgts_t applied = tgts;
+    if ( sim ) {
+        const sim_params_t p = simGetParams();
+        applied.wind = p.wind_mmps;
+        applied.incline = p.grade;
+        applied.crr = p.crr;
+        applied.cw = p.cw;
+    }
+    if ( tgts.resistance != 0xFF ) {
+        applied.resistance = disp_res;
+    }
+    ftmsStatusTargets ( applied );
 }
 
 void initBike()
@@ -220,6 +383,7 @@ int new_msg ( uint8_t *buff, size_t len )
         uint16_t value = ascii_to_int_4 ( buff + 10 );
         if ( nodeId == RPM_NODE ) {
             act_rpm = value;
+            rpm_ms = k_uptime_get_32();
             return 0;
         } else if ( nodeId == INC_NODE ) {
             if ( !firstRead ) {
@@ -241,100 +405,82 @@ static float power ( float base, int pwr )
     return pwr == 0 ? 1.0 : base * power ( base, pwr - 1 );
 }
 
-//
-// The following "Phyics-Based" model is based on analysis of coast-down data
-// collected from an s22i bike. It estimates the power required to maintain a
-// given flywheel speed (in RPM) at a given eddy-current brake level (1..22).
-// The model accounts for both eddy-current drag and Coulomb friction losses,   
-// and can be adapted to either crank or flywheel speed sensors.
-//
-
-/*** BIKE CONSTANTS ***/
-#define SENSOR_IS_CRANK            1          // 1 = rpm is crank cadence; 0 = flywheel
-#define R_FLYWHEEL_PER_CRANK       5.317f
-#define DRIVETRAIN_ETA             0.95f
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-static inline double rpm_to_rads(double rpm){ return rpm * (2.0 * M_PI / 60.0); }
-
-/*** Eddy-current k(L): log-linear interpolation over anchors ***/
-static const int    K_LVLS[] = {  1,   4,   10,   13,   16,    18,    20,    22 };
-static const double K_VALS[] = { 0.0308857954, 0.0308857954, 0.0458868358, 0.0619309863,
-                                 0.0753609278, 0.1123894586, 0.1123894586, 0.1635043007 };
-static const int K_COUNT = sizeof(K_LVLS)/sizeof(K_LVLS[0]);
-
-static double k_for_level(int L){
-    if (L <= K_LVLS[0]) return K_VALS[0];
-    if (L >= K_LVLS[K_COUNT-1]) return K_VALS[K_COUNT-1];
-    for (int i=0;i<K_COUNT-1;i++){
-        int L0 = K_LVLS[i], L1 = K_LVLS[i+1];
-        if (L >= L0 && L <= L1){
-            double y0 = log(K_VALS[i]), y1 = log(K_VALS[i+1]);
-            double t  = (double)(L - L0) / (double)(L1 - L0);
-            return exp(y0 + t*(y1 - y0));
-        }
-    }
-    return K_VALS[K_COUNT-1];
-}
-
-/*** Coulomb friction torque vs level (N·m) ***/
-static inline double Tc_for_level(int L){
-    const double a = 0.0166779771;   // N·m per level
-    const double b = 0.4338270944;   // N·m base
-    double Tc = b + a * (double)L;
-    return (Tc > 0.0) ? Tc : 0.0;
-}
-
-/*** CORE API: pass crank rpm and resistance level ***/
-uint16_t calc_watts_physics_params(double rpm_crank, int level)
-{
-    if (rpm_crank <= 0.0) return 0;
-    if (level < 1) level = 1; else if (level > 22) level = 22;
-
-    // flywheel angular speed
-    double rpm_fly = SENSOR_IS_CRANK ? rpm_crank * (double)R_FLYWHEEL_PER_CRANK : rpm_crank;
-    double omega   = rpm_to_rads(rpm_fly); // rad/s
-
-    // model
-    double k  = k_for_level(level);   // W / (rad/s)^2
-    double Tc = Tc_for_level(level);  // N·m
-    double Pf = k*(omega*omega) + Tc*omega;      // flywheel watts
-    if (!(Pf > 0.0)) Pf = 0.0;
-
-    double W  = Pf / (double)DRIVETRAIN_ETA;     // pedal watts
-    if (W < 1.0) W = 1.0;
-    if (W > 65535.0) W = 65535.0;
-    return (uint16_t)(W + 0.5);
-}
-
 static void updateResistance()
 {
-    const uint16_t new_res = calc_res();
+    const uint16_t trace = ( uint16_t )atomic_set ( &res_trace, 0 );
+    uint16_t new_res;
+    switch ( mode ) {
+        case MODE_ERG:
+            new_res = ergUpdate ( act_rpm );
+            break;
+        case MODE_SIM:
+            new_res = simUpdate ( act_rpm );
+            break;
+        default:
+            new_res = calc_res();
+    }
     if ( SET_RES.value != new_res ) {
         SET_RES.value = new_res;
         LOG_INF ( "Changing resistance magnitude to: %d", new_res );
-        sendWithRetries ( SET_RES, 3, 50 );
+        send_retries ( SET_RES, 3, 50, trace );
+    } else {
+        release_trace ( trace, &inc_trace );
+    }
+}
+
+// Measure incline slew from consecutive readbacks while moving
+static void track_slew ( uint16_t prev_inc )
+{
+    static uint32_t last_ms = 0;
+    static bool moving = false;
+    const uint32_t now_ms = k_uptime_get_32();
+    const uint16_t cnts
+        = act_inc > prev_inc ? act_inc - prev_inc : prev_inc - act_inc;
+    if ( moving && cnts ) {
+        const uint32_t sample = ( now_ms - last_ms ) / cnts;
+        inc_ms_per_cnt = ( 3 * inc_ms_per_cnt + sample ) / 4;
     }
+    last_ms = now_ms;
+    moving = act_inc != SET_INC.value;
 }
 
 void updateBike()
 {
     sendWithRetries ( RPM_REQ, 0, 0 );
+    const uint16_t trace = ( uint16_t )atomic_set ( &inc_trace, 0 );
     if ( firstRead && ( act_inc != SET_INC.value ) ) {
-        sendWithRetries ( SET_INC, 1, 50 );
+        const uint16_t prev_inc = act_inc;
+        send_retries ( SET_INC, 1, 50, trace );
         sendWithRetries ( INC_REQ, 0, 50 );
+        track_slew ( prev_inc );
+    } else {
+        release_trace ( trace, &res_trace );
     }
     updateResistance();
 }
 
+// Sleep out the rest of a cycle, applying shifts as soon as they happen
+void waitBikeInput ( uint32_t timeout_ms )
+{
+    const uint32_t start_ms = k_uptime_get_32();
+    uint32_t elapsed_ms = 0;
+    while ( elapsed_ms < timeout_ms ) {
+        if ( k_sem_take ( &shift_sem, K_MSEC ( timeout_ms - elapsed_ms ) ) ) {
+            return;
+        }
+        updateResistance();
+        elapsed_ms = k_uptime_get_32() - start_ms;
+    }
+}
+
 bike_data_t getBikeData()
 {
     bike_data_t data;
     data.act_rpm = act_rpm;
+    data.rpm_ms = rpm_ms;
     data.disp_res = disp_res;
     data.tgt_inc = SET_INC.value;
-    data.watts = calc_watts_physics_params((double)act_rpm, calc_res());
+    data.gear = mode == MODE_SIM ? simGetGear() + 1 : 0;
+    data.watts = pmWatts ( act_rpm, SET_RES.value );
     return data;
 }
\ No newline at end of file
@@ -0,0 +1,132 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "broadcast.h"
+
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "advertising.h"
+#include "telemetry.h"
+
+LOG_MODULE_REGISTER ( bcast );
+
+// Observers parse this layout
+BUILD_ASSERT ( sizeof ( bcast_frame_t ) == 13 );
+
+static const struct bt_data ad [] = {
+    BT_DATA_BYTES ( BT_DATA_UUID128_ALL, BT_UUID_BCAST_VAL ),
+    BT_DATA ( BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN ),
+};
+
+// Service UUID followed by the frame
+static uint8_t svc_data [BT_UUID_SIZE_128 + sizeof ( bcast_frame_t )]
+    = { BT_UUID_BCAST_VAL };
+static const struct bt_data per_ad [] = {
+    BT_DATA ( BT_DATA_SVC_DATA128, svc_data, sizeof ( svc_data ) ),
+};
+
+static const struct bt_le_adv_param *EXT_PARAM = BT_LE_ADV_PARAM (
+    BT_LE_ADV_OPT_EXT_ADV, BCAST_EXT_INT_MIN, BCAST_EXT_INT_MAX, NULL );
+static const struct bt_le_per_adv_param *PER_PARAM = BT_LE_PER_ADV_PARAM (
+    BCAST_PER_INT_MIN, BCAST_PER_INT_MAX, BT_LE_PER_ADV_OPT_NONE );
+
+static void bcast_work_handler ( struct k_work *work );
+K_WORK_DELAYABLE_DEFINE ( bcast_work, bcast_work_handler );
+
+// Only touched from the system work queue after start
+static struct bt_le_ext_adv *adv = NULL;
+static bcast_frame_t frame = { .version = BCAST_FRAME_VERSION };
+
+// Returns true when the frame changed
+static bool encode ( const bike_data_t *data )
+{
+    bcast_frame_t next = frame;
+    if ( data->invalid & BIKE_SAMPLE_RPM ) {
+        next.watts = 0xFFFF;
+        next.rpm = 0xFFFF;
+    } else {
+        next.watts = sys_cpu_to_le16 ( data->watts );
+        next.rpm = sys_cpu_to_le16 ( data->act_rpm );
+    }
+    next.incline = sys_cpu_to_le16 ( data->tgt_inc );
+    next.resistance = data->disp_res;
+    next.elapsed_ms = sys_cpu_to_le32 ( data->ride.elapsed_ms );
+    if ( !memcmp ( &next, &frame, sizeof ( frame ) ) ) {
+        return false;
+    }
+    next.seq++;
+    frame = next;
+    return true;
+}
+
+static int publish()
+{
+    memcpy ( &svc_data [BT_UUID_SIZE_128], &frame, sizeof ( frame ) );
+    return bt_le_per_adv_set_data ( adv, per_ad, ARRAY_SIZE ( per_ad ) );
+}
+
+static void bcast_work_handler ( struct k_work *work )
+{
+    const bike_data_t data = telemetryGetSnapshot();
+    if ( encode ( &data ) ) {
+        int err = publish();
+        if ( err ) {
+            LOG_WRN ( "Broadcast update failed (err %d)", err );
+        }
+    }
+    k_work_schedule ( &bcast_work, K_MSEC ( BCAST_UPDATE_MS ) );
+}
+
+// Runs next to the connectable advertising in its own set
+void bcastStart()
+{
+    const bike_data_t data = telemetryGetSnapshot();
+    encode ( &data );
+
+    int err = bt_le_ext_adv_create ( EXT_PARAM, NULL, &adv );
+    if ( err ) {
+        LOG_ERR ( "Broadcast set create failed (err %d)", err );
+        return;
+    }
+    err = bt_le_ext_adv_set_data ( adv, ad, ARRAY_SIZE ( ad ), NULL, 0 );
+    if ( !err ) {
+        err = bt_le_per_adv_set_param ( adv, PER_PARAM );
+    }
+    if ( !err ) {
+        err = publish();
+    }
+    if ( !err ) {
+        err = bt_le_per_adv_start ( adv );
+    }
+    if ( !err ) {
+        err = bt_le_ext_adv_start ( adv, BT_LE_EXT_ADV_START_DEFAULT );
+    }
+    if ( err ) {
+        LOG_ERR ( "Broadcast start failed (err %d)", err );
+        return;
+    }
+
+    LOG_INF ( "Broadcasting telemetry" );
+    k_work_schedule ( &bcast_work, K_MSEC ( BCAST_UPDATE_MS ) );
+}
@@ -30,6 +30,8 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/types.h>
 
+#include "telemetry.h"
+
 LOG_MODULE_REGISTER ( cps );
 static bool notify_enabled = false;
 
@@ -78,30 +80,54 @@ BT_GATT_SERVICE_DEFINE (
     BT_GATT_CCC ( cps_ccc_cfg_changed,
                   ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ) );
 
-static int cps_init ( const struct device *dev )
+static size_t encode_measurement ( const bike_data_t *bikeData,
+                                   uint8_t *buf,
+                                   size_t len )
 {
-    ARG_UNUSED ( dev );
+    ble_cps_measurement_data_t data = {};
+    BUILD_ASSERT ( sizeof ( data ) <= TELEMETRY_MIN_LEN );
 
-    /// cps_features doesn't use any optional flags
+    data.flags = BLE_CPS_ACCUMULATED_TORQUE_FLAGS_FIELD
+                 | BLE_CPS_TORQUE_SOURCE_CRANK_FLAG | BLE_CPS_WHEEL_FLAGS_FIELD
+                 | BLE_CPS_CRANK_FLAGS_FIELD
+                 | BLE_CPS_ACCUMULATED_ENERGY_FLAGS_FIELD;
+    data.InstantaneousPower = bikeData->watts;
 
-    return 0;
+    // Work per revolution is torque * 2 pi
+    data.accTorque_32 = ( bikeData->energy_j * 32000ULL ) / 6283ULL;
+    data.wheelRevs_cnt = bikeData->wheel_revs;
+    data.lastWheel_2048 = ( bikeData->wheel_evt_ms * 256ULL ) / 125ULL;
+    data.totalRevs_cnt = bikeData->crank_revs;
+    data.lastCrank_1024 = bikeData->crank_evt_1024;
+    data.accEnergy_kj = bikeData->energy_j / 1000;
+    memcpy ( buf, &data, sizeof ( data ) );
+    return sizeof ( data );
 }
 
-int bt_cps_notify ( bike_data_t bikeData )
+// Sent as each crank revolution completes
+static uint32_t measurement_event ( const bike_data_t *bikeData )
 {
-    if ( !notify_enabled ) {
-        return -EACCES;
-    }
-
-    static ble_cps_measurement_data_t data = {};
-    data.InstantaneousPower = bikeData.watts;
-
-    int rc = bt_gatt_notify_uuid ( NULL,
-                                   BLE_UUID_CYCLING_POWER_MEASUREMENT_CHAR,
-                                   cps_svc.attrs,
-                                   &data,
-                                   sizeof ( data ) );
-    return rc == -ENOTCONN ? 0 : rc;
+    return bikeData->crank_revs;
+}
+
+static telemetry_chan_t measurement_chan = {
+    .name = "cps",
+    .encode = encode_measurement,
+    .event = measurement_event,
+    .period_ms = TELEMETRY_ON_SAMPLE,
+};
+
+static int cps_init ( const struct device *dev )
+{
+    ARG_UNUSED ( dev );
+
+    cps_features.feat_blsc
+        = BLE_CPS_FEATURE_ACCUMULATED_TORQUE | BLE_CPS_FEATURE_WHEEL_REV
+          | BLE_CPS_FEATURE_CRANK_REV | BLE_CPS_FEATURE_ACCUMULATED_ENERGY;
+
+    return telemetryRegister ( &measurement_chan,
+                               &cps_svc,
+                               BLE_UUID_CYCLING_POWER_MEASUREMENT_CHAR );
 }
 
 SYS_INIT ( cps_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY );
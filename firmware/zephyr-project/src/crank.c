@@ -0,0 +1,128 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crank.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "telemetry.h"
+
+#define REV_Q16 ( 1UL << 16 )
+
+LOG_MODULE_REGISTER ( crank );
+
+static uint32_t phase_q16 = 0;  // Part revolution since the last event
+static uint32_t crank_revs = 0;
+static uint32_t crank_evt_1024 = 0;
+static uint64_t energy_mj = 0;
+static uint16_t last_rpm = 0;
+static uint32_t last_ms = 0;
+static bool started = false;
+static struct k_spinlock lock;
+
+static uint64_t ms_to_1024 ( uint64_t ms )
+{
+    return ( ms * 128 ) / 125;
+}
+
+// Cadence is taken as linear between samples, so the revolutions in the
+// interval are the trapezoid and the last one is placed inside it
+static void update_crank ( uint16_t rpm, uint32_t now_ms, uint32_t dt_ms )
+{
+    const uint64_t travel_q16
+        = ( ( uint64_t )( last_rpm + rpm ) * dt_ms * REV_Q16 ) / 120000;
+    if ( !travel_q16 ) {
+        return;
+    }
+
+    const uint32_t revs = ( phase_q16 + travel_q16 ) / REV_Q16;
+    if ( revs ) {
+        // Share of the interval it took to finish the last revolution
+        const uint64_t to_evt_q16 = revs * REV_Q16 - phase_q16;
+        const uint64_t start_1024 = ms_to_1024 ( now_ms - dt_ms );
+        const uint64_t span_1024 = ms_to_1024 ( dt_ms );
+        crank_evt_1024 = start_1024 + ( to_evt_q16 * span_1024 ) / travel_q16;
+        crank_revs += revs;
+    }
+    phase_q16 = ( phase_q16 + travel_q16 ) % REV_Q16;
+}
+
+static void evt_work_handler ( struct k_work *work );
+static K_WORK_DELAYABLE_DEFINE ( evt_work, evt_work_handler );
+
+// Time left in the current revolution at the last cadence, rounded up so
+// the work never runs just short of the event
+static void schedule_evt()
+{
+    if ( !last_rpm ) {
+        k_work_cancel_delayable ( &evt_work );
+        return;
+    }
+    const uint64_t left_q16 = REV_Q16 - phase_q16;
+    const uint64_t div = ( uint64_t )last_rpm * REV_Q16;
+    const uint32_t ms = ( left_q16 * 60000 + div - 1 ) / div;
+    k_work_reschedule ( &evt_work, K_MSEC ( ms ) );
+}
+
+// Runs at the predicted crank event so notifications follow the pedals
+// rather than the sample loop, cadence is held since the last sample
+static void evt_work_handler ( struct k_work *work )
+{
+    const uint32_t now_ms = k_uptime_get_32();
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    uint32_t dt_ms = now_ms - last_ms;
+    if ( dt_ms > CRANK_MAX_DT_MS ) {
+        dt_ms = CRANK_MAX_DT_MS;
+    }
+    const uint32_t revs = crank_revs;
+    update_crank ( last_rpm, now_ms, dt_ms );
+    last_ms = now_ms;
+    const uint32_t new_revs = crank_revs;
+    const uint32_t evt_1024 = crank_evt_1024;
+    schedule_evt();
+    k_spin_unlock ( &lock, key );
+
+    if ( new_revs != revs ) {
+        telemetryPublishCrank ( new_revs, evt_1024 );
+    }
+}
+
+// Call once per sample, fills in crank events and accumulated energy
+void crankUpdate ( bike_data_t *data, uint32_t now_ms )
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    uint32_t dt_ms = started ? now_ms - last_ms : 0;
+    last_ms = now_ms;
+    started = true;
+    if ( dt_ms > CRANK_MAX_DT_MS ) {
+        dt_ms = CRANK_MAX_DT_MS;
+    }
+
+    update_crank ( data->act_rpm, now_ms, dt_ms );
+    last_rpm = data->act_rpm;
+    energy_mj += ( uint64_t )data->watts * dt_ms;
+    schedule_evt();
+
+    data->crank_revs = crank_revs;
+    data->crank_evt_1024 = crank_evt_1024;
+    data->energy_j = energy_mj / 1000;
+    k_spin_unlock ( &lock, key );
+}
@@ -30,6 +30,8 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/types.h>
 
+#include "telemetry.h"
+
 LOG_MODULE_REGISTER ( cscs );
 static bool notify_enabled = false;
 
@@ -79,54 +81,44 @@ BT_GATT_SERVICE_DEFINE (
     BT_GATT_CCC ( cscs_ccc_cfg_changed,
                   ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ) );
 
-static int cscs_init ( const struct device *dev )
+static size_t encode_measurement ( const bike_data_t *bikeData,
+                                   uint8_t *buf,
+                                   size_t len )
 {
-    ARG_UNUSED ( dev );
-
-    cscs_features.feat_blsc = BLE_CSCS_FEATURE_CRANK_REV;
-
-    return 0;
+    ble_cscs_measurement_data_t data = {};
+    BUILD_ASSERT ( sizeof ( data ) <= TELEMETRY_MIN_LEN );
+
+    data.flags = BLE_CSCS_WHEEL_FLAGS_FIELD | BLE_CSCS_CRANK_FLAGS_FIELD;
+    data.wheelRevs_cnt = bikeData->wheel_revs;
+    data.lastWheel_1024 = ( bikeData->wheel_evt_ms * 128ULL ) / 125ULL;
+    data.totalRevs_cnt = bikeData->crank_revs;
+    data.lastCrank_1024 = bikeData->crank_evt_1024;
+    memcpy ( buf, &data, sizeof ( data ) );
+    return sizeof ( data );
 }
 
-static void set_crank_data ( uint16_t rpm, ble_cscs_measurement_data_t *data )
+// Sent as each wheel or crank revolution completes
+static uint32_t measurement_event ( const bike_data_t *bikeData )
 {
-    data->flags = BLE_CSCS_CRANK_FLAGS_FIELD;
-
-    // Handle first call/zero rpm
-    static uint32_t lastRev_ms = 0;
-    if ( !lastRev_ms || !rpm ) {
-        lastRev_ms = k_uptime_get_32();
-        return;
-    }
-
-    // Get elapsed time since last revolution
-    int64_t elapsed_ms = k_uptime_get_32() - lastRev_ms;
-    if ( elapsed_ms < 0 ) {
-        elapsed_ms += 1LL << 32;
-    }
-
-    // Compute data
-    int64_t elapsed_revs = ( elapsed_ms * rpm ) / 60000LL;
-    data->totalRevs_cnt += elapsed_revs;
-    lastRev_ms += ( 60000LL * elapsed_revs ) / rpm;
-    data->lastCrank_1024 = ( lastRev_ms * 128LL ) / 125LL;
+    return bikeData->wheel_revs + bikeData->crank_revs;
 }
 
-int bt_cscs_bike_notify ( bike_data_t bikeData )
+static telemetry_chan_t measurement_chan = {
+    .name = "cscs",
+    .encode = encode_measurement,
+    .event = measurement_event,
+    .period_ms = TELEMETRY_ON_SAMPLE,
+};
+
+static int cscs_init ( const struct device *dev )
 {
-    if ( !notify_enabled ) {
-        return -EACCES;
-    }
-
-    static ble_cscs_measurement_data_t data = {};
-    set_crank_data ( bikeData.act_rpm, &data );
-
-    int rc = bt_gatt_notify_uuid ( NULL,
-                                   BLE_UUID_CSCS_MEASUREMENT_CHAR,
-                                   cscs_svc.attrs,
-                                   &data,
-                                   sizeof ( data ) );
-    return rc == -ENOTCONN ? 0 : rc;
+    ARG_UNUSED ( dev );
+
+    cscs_features.feat_blsc
+        = BLE_CSCS_FEATURE_WHEEL_REV | BLE_CSCS_FEATURE_CRANK_REV;
+
+    return telemetryRegister (
+        &measurement_chan, &cscs_svc, BLE_UUID_CSCS_MEASUREMENT_CHAR );
 }
 
 SYS_INIT ( cscs_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY );
\ No newline at end of file
@@ -0,0 +1,173 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dfu.h"
+
+#include <stdbool.h>
+#include <img_mgmt/img_mgmt.h>
+#include <mgmt/mgmt.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "hrs.h"
+#include "link.h"
+#include "telemetry.h"
+
+LOG_MODULE_REGISTER ( dfu );
+
+static void idle_work_handler ( struct k_work *work );
+K_WORK_DELAYABLE_DEFINE ( idle_work, idle_work_handler );
+
+// Set from the mcumgr work queue, the idle timeout only fires once chunks
+// have stopped coming
+static bool active = false;
+static uint32_t start_ms = 0;
+static uint32_t total = 0;
+static uint32_t last_off = 0;
+static uint32_t logged_off = 0;
+
+// Chunk handling time, mostly the flash write, and chunks that were
+// already waiting when the previous one finished
+static uint32_t chunk_cyc = 0;
+static uint32_t done_cyc = 0;
+static uint32_t busy_us = 0;
+static uint32_t chunks = 0;
+static uint32_t queued = 0;
+
+static uint32_t rate_bps ( uint32_t bytes )
+{
+    const uint32_t ms = k_uptime_get_32() - start_ms;
+    return ms ? ( uint64_t )bytes * 1000 / ms : 0;
+}
+
+// Link and telemetry get out of the way for the whole upload
+static void begin()
+{
+    if ( active ) {
+        return;
+    }
+    active = true;
+    start_ms = k_uptime_get_32();
+    last_off = 0;
+    logged_off = 0;
+    busy_us = 0;
+    chunks = 0;
+    queued = 0;
+    linkSetDfu ( true );
+    telemetryPause ( true );
+    hrsPause ( true );
+    LOG_INF ( "Upload started" );
+}
+
+static void end ( const char *how )
+{
+    k_work_cancel_delayable ( &idle_work );
+    if ( !active ) {
+        return;
+    }
+    active = false;
+    linkSetDfu ( false );
+    telemetryPause ( false );
+    hrsPause ( false );
+    LOG_INF ( "Upload %s: %u bytes in %u ms, %u bytes/s",
+              how,
+              last_off,
+              k_uptime_get_32() - start_ms,
+              rate_bps ( last_off ) );
+    LOG_INF ( "Upload chunks busy %u ms, %u of %u received while writing",
+              busy_us / 1000,
+              queued,
+              chunks );
+}
+
+static void idle_work_handler ( struct k_work *work )
+{
+    end ( "abandoned" );
+}
+
+static int upload_cb ( uint32_t offset, uint32_t size, void *arg )
+{
+    begin();
+    total = size;
+    last_off = offset;
+    if ( offset - logged_off >= DFU_LOG_BYTES ) {
+        logged_off = offset;
+        LOG_INF ( "Upload %u / %u bytes, %u bytes/s",
+                  offset,
+                  size,
+                  rate_bps ( offset ) );
+    }
+    k_work_reschedule ( &idle_work, K_MSEC ( DFU_IDLE_MS ) );
+    return 0;
+}
+
+static void dfu_started()
+{
+    begin();
+}
+
+static void dfu_stopped()
+{
+    end ( "stopped" );
+}
+
+static void dfu_pending()
+{
+    last_off = total;
+    end ( "complete" );
+}
+
+// Runs on the mcumgr work queue around every command it handles
+static void mgmt_evt ( uint8_t opcode, uint16_t group, uint8_t id, void *arg )
+{
+    if ( ( group != MGMT_GROUP_ID_IMAGE ) || ( id != IMG_MGMT_ID_UPLOAD ) ) {
+        return;
+    }
+    const uint32_t now_cyc = k_cycle_get_32();
+    if ( opcode == MGMT_EVT_OP_CMD_RECV ) {
+        if ( chunks
+             && ( k_cyc_to_us_floor32 ( now_cyc - done_cyc )
+                  < DFU_QUEUED_US ) ) {
+            queued++;
+        }
+        chunk_cyc = now_cyc;
+    } else if ( opcode == MGMT_EVT_OP_CMD_DONE ) {
+        busy_us += k_cyc_to_us_floor32 ( now_cyc - chunk_cyc );
+        done_cyc = now_cyc;
+        chunks++;
+    }
+}
+
+static const struct img_mgmt_dfu_callbacks_t dfu_callbacks = {
+    .dfu_started_cb = dfu_started,
+    .dfu_stopped_cb = dfu_stopped,
+    .dfu_pending_cb = dfu_pending,
+};
+
+static int dfu_init ( const struct device *dev )
+{
+    ARG_UNUSED ( dev );
+
+    img_mgmt_register_callbacks ( &dfu_callbacks );
+    img_mgmt_set_upload_cb ( upload_cb, NULL );
+    mgmt_register_evt_cb ( mgmt_evt );
+    return 0;
+}
+
+SYS_INIT ( dfu_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY );
@@ -0,0 +1,125 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "diag.h"
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/types.h>
+
+#include "dsp.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "workout.h"
+
+LOG_MODULE_REGISTER ( diag );
+
+// Counters are copied on every read so long reads stay consistent
+static ssize_t read_telemetry ( struct bt_conn *conn,
+                                const struct bt_gatt_attr *attr,
+                                void *buf,
+                                uint16_t len,
+                                uint16_t offset )
+{
+    static telemetry_stats_t stats;
+    if ( !offset ) {
+        stats = telemetryGetStats();
+    }
+    return bt_gatt_attr_read (
+        conn, attr, buf, len, offset, &stats, sizeof ( stats ) );
+}
+
+// Control latency histograms, same snapshot rule
+static ssize_t read_trace ( struct bt_conn *conn,
+                            const struct bt_gatt_attr *attr,
+                            void *buf,
+                            uint16_t len,
+                            uint16_t offset )
+{
+    static trace_stats_t stats;
+    if ( !offset ) {
+        stats = traceGetStats();
+    }
+    return bt_gatt_attr_read (
+        conn, attr, buf, len, offset, &stats, sizeof ( stats ) );
+}
+
+// Filter benchmark, cycles per sample on whatever build is running
+static ssize_t read_dsp ( struct bt_conn *conn,
+                          const struct bt_gatt_attr *attr,
+                          void *buf,
+                          uint16_t len,
+                          uint16_t offset )
+{
+    static dsp_stats_t stats;
+    if ( !offset ) {
+        stats = dspGetStats();
+    }
+    return bt_gatt_attr_read (
+        conn, attr, buf, len, offset, &stats, sizeof ( stats ) );
+}
+
+// Workout upload, an array of workout_rec_t in a single write
+static ssize_t write_workout ( struct bt_conn *conn,
+                               const struct bt_gatt_attr *attr,
+                               const void *buf,
+                               uint16_t len,
+                               uint16_t offset,
+                               uint8_t flags )
+{
+    if ( offset ) {
+        return BT_GATT_ERR ( BT_ATT_ERR_INVALID_OFFSET );
+    } else if ( !len || ( len % sizeof ( workout_rec_t ) ) ) {
+        return BT_GATT_ERR ( BT_ATT_ERR_INVALID_ATTRIBUTE_LEN );
+    } else if ( workoutLoad ( buf, len / sizeof ( workout_rec_t ) ) ) {
+        return BT_GATT_ERR ( BT_ATT_ERR_VALUE_NOT_ALLOWED );
+    }
+    return len;
+}
+
+BT_GATT_SERVICE_DEFINE (
+    diag_svc,
+    BT_GATT_PRIMARY_SERVICE ( BT_UUID_DIAG ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_DIAG_TELEMETRY_CHAR,
+                             BT_GATT_CHRC_READ,
+                             BT_GATT_PERM_READ,
+                             read_telemetry,
+                             NULL,
+                             NULL ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_DIAG_TRACE_CHAR,
+                             BT_GATT_CHRC_READ,
+                             BT_GATT_PERM_READ,
+                             read_trace,
+                             NULL,
+                             NULL ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_DIAG_DSP_CHAR,
+                             BT_GATT_CHRC_READ,
+                             BT_GATT_PERM_READ,
+                             read_dsp,
+                             NULL,
+                             NULL ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_DIAG_WORKOUT_CHAR,
+                             BT_GATT_CHRC_WRITE,
+                             BT_GATT_PERM_WRITE,
+                             NULL,
+                             write_workout,
+                             NULL ), );
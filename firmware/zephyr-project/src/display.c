@@ -19,6 +19,7 @@
 #include "display.h"
 
 #include <lvgl.h>
+#include <string.h>
 #include <zephyr/drivers/display.h>
 #include <zephyr/drivers/kscan.h>
 #include <zephyr/drivers/pwm.h>
@@ -26,7 +27,9 @@
 #include <zephyr/logging/log.h>
 
 #include "common.h"
+#include "metrics.h"
 #include "version.h"
+#include "workout.h"
 
 #define BL_PWM_NODE DT_ALIAS ( blpwm )
 #define PWM_PERIOD PWM_MSEC ( 1U )  // 1 kHz
@@ -59,18 +62,23 @@ static lv_obj_t *inc_desc_label;
 static lv_obj_t *res_desc_label;
 static lv_obj_t *version_label;
 static lv_obj_t *swLabel;
+static lv_obj_t *spdLabel;
+static lv_obj_t *distLabel;
+static lv_obj_t *hrLabel;
 static lv_obj_t *btnLabel;
 static lv_obj_t *btn;
 static lv_style_t style;
 static lv_style_t descStyle;
 static lv_style_t shaStyle;
 static lv_style_t btnStyle;
-static stopwatch_data_t swData;
 static char rpmString [4];                 // 999
 static char pwrString [5];                 // 9999
 static char incString [7];                 // -10.0%
 static char resString [3];                 // 99
 static char swString [9];                  // 00:00:00
+static char spdString [10];                // 99.9km/h
+static char distString [10];               // 999.99km
+static char hrString [7];                  // 255bpm
 static char versionString [MAX_VERSION_LEN];
 
 void updateBacklight ( bool wakeUp )
@@ -119,56 +127,37 @@ static void k_callback ( const struct device *dev,
 void resetTime()
 {
     LOG_INF ( "Resetting timer..." );
-    memset ( &swData, 0, sizeof ( stopwatch_data_t ) );
+    metricsReset();
 }
 
-static void incrementStopwatch ( int64_t elapsed_ms )
+static void updateSwString ( uint32_t elapsed_ms )
 {
-    if ( elapsed_ms < 0 ) {
-        elapsed_ms += 1LL << 32;
-    }
-    swData.ms += elapsed_ms;
-    while ( swData.ms >= 1000 ) {
-        swData.secs++;
-        swData.ms -= 1000;
-    }
-    while ( swData.secs >= 60 ) {
-        swData.mins++;
-        swData.secs -= 60;
-    }
-    while ( swData.mins >= 60 ) {
-        swData.hrs++;
-        swData.mins -= 60;
-    }
+    // Moving time comes from the ride metrics
+    const unsigned int secs = elapsed_ms / 1000;
+    sprintf ( &swString [0],
+              "%02u:%02u:%02u",
+              ( secs / 3600 ) % 100,
+              ( secs / 60 ) % 60,
+              secs % 60 );
 }
 
-static void updateSwString()
+// Dashes while the bus reading is flagged invalid
+static void updateRpmString ( uint16_t act_rpm, bool valid )
 {
-    if ( swData.hrs < 10 ) {
-        sprintf ( &swString [0], "0%u:", swData.hrs );
-    } else {
-        sprintf ( &swString [0], "%u:", swData.hrs );
-    }
-    if ( swData.mins < 10 ) {
-        sprintf ( &swString [3], "0%u:", swData.mins );
-    } else {
-        sprintf ( &swString [3], "%u:", swData.mins );
-    }
-    if ( swData.secs < 10 ) {
-        sprintf ( &swString [6], "0%u", swData.secs );
+    if ( valid ) {
+        sprintf ( &rpmString [0], "%u", act_rpm );
     } else {
-        sprintf ( &swString [6], "%u", swData.secs );
+        strcpy ( &rpmString [0], "--" );
     }
 }
 
-static void updateRpmString ( uint16_t act_rpm )
+static void updatePwrString ( uint16_t watts, bool valid )
 {
-    sprintf ( &rpmString [0], "%u", act_rpm );
-}
-
-static void updatePwrString ( uint16_t watts )
-{
-    sprintf ( &pwrString [0], "%u", watts );
+    if ( valid ) {
+        sprintf ( &pwrString [0], "%u", watts );
+    } else {
+        strcpy ( &pwrString [0], "--" );
+    }
 }
 
 static void updateIncString ( uint16_t tgt_inc )
@@ -181,34 +170,61 @@ static void updateIncString ( uint16_t tgt_inc )
     }
 }
 
-static void updateResString ( uint16_t disp_res )
+static void updateResString ( uint16_t disp_res, uint8_t gear )
+{
+    static bool showGear = false;
+
+    // Resistance tile doubles as the gear indicator while simulating
+    if ( showGear != ( gear != 0 ) ) {
+        showGear = gear != 0;
+        lv_label_set_text ( res_desc_label, showGear ? "Gear" : "Resistance" );
+    }
+    sprintf ( &resString [0], "%u", showGear ? gear : disp_res );
+}
+
+static void updateSpdString ( uint16_t speed_mmps )
+{
+    const unsigned int kph_10 = ( speed_mmps * 36UL + 500 ) / 1000;
+    sprintf ( &spdString [0], "%u.%ukm/h", kph_10 / 10, kph_10 % 10 );
+}
+
+static void updateDistString ( uint32_t distance_m )
+{
+    const unsigned int dam = ( distance_m / 10 ) % 100000;
+    sprintf ( &distString [0], "%u.%02ukm", dam / 100, dam % 100 );
+}
+
+// Blank without a strap
+static void updateHrString ( uint8_t heart_bpm )
 {
-    sprintf ( &resString [0], "%u", disp_res );
+    if ( heart_bpm ) {
+        sprintf ( &hrString [0], "%ubpm", heart_bpm );
+    } else {
+        hrString [0] = '\0';
+    }
 }
 
 static void updateLabels ( bike_data_t bikeData )
 {
-    updateRpmString ( bikeData.act_rpm );
-    updatePwrString ( bikeData.watts );
+    const bool rpm_valid = !( bikeData.invalid & BIKE_SAMPLE_RPM );
+    const bool hr_valid = !( bikeData.invalid & BIKE_SAMPLE_HR );
+    updateRpmString ( bikeData.rpm_filt, rpm_valid );
+    updatePwrString ( bikeData.watts_3s, rpm_valid );
     updateIncString ( bikeData.tgt_inc );
-    updateResString ( bikeData.disp_res );
-    updateSwString();
+    updateResString ( bikeData.disp_res, bikeData.gear );
+    updateSwString ( bikeData.ride.elapsed_ms );
+    updateSpdString ( bikeData.speed_mmps );
+    updateDistString ( bikeData.ride.distance_m );
+    updateHrString ( hr_valid ? bikeData.heart_bpm : 0 );
 
     lv_label_set_text_fmt ( rpm_label, "%s", rpmString );
     lv_label_set_text_fmt ( pwr_label, "%s", pwrString );
     lv_label_set_text_fmt ( inc_label, "%s", incString );
     lv_label_set_text_fmt ( res_label, "%s", resString );
     lv_label_set_text_fmt ( swLabel, "%s", swString );
-}
-
-static void updateStopwatch ( bool running )
-{
-    const uint32_t now_ms = k_uptime_get_32();
-    if ( swData.running ) {
-        incrementStopwatch ( now_ms - swData.last_ms );
-    }
-    swData.running = running;
-    swData.last_ms = now_ms;
+    lv_label_set_text_fmt ( spdLabel, "%s", spdString );
+    lv_label_set_text_fmt ( distLabel, "%s", distString );
+    lv_label_set_text_fmt ( hrLabel, "%s", hrString );
 }
 
 static void screenCb ( lv_event_t *e )
@@ -218,14 +234,22 @@ static void screenCb ( lv_event_t *e )
 
 static void buttonCb ( lv_event_t *e )
 {
-    LOG_INF ( "Timer reset button depressed!" );
+    LOG_INF ( "Timer reset button clicked!" );
     resetTime();
 }
 
+static void buttonLongCb ( lv_event_t *e )
+{
+    LOG_INF ( "Timer reset button held!" );
+    workoutToggle();
+}
+
 static void drawButton()
 {
     btn = lv_btn_create ( lv_scr_act() );
-    lv_obj_add_event_cb ( btn, buttonCb, LV_EVENT_PRESSED, NULL );
+    // Short click only, a long press also starts with PRESSED
+    lv_obj_add_event_cb ( btn, buttonCb, LV_EVENT_SHORT_CLICKED, NULL );
+    lv_obj_add_event_cb ( btn, buttonLongCb, LV_EVENT_LONG_PRESSED, NULL );
     lv_obj_align ( btn, LV_ALIGN_TOP_MID, 0, 410 );
     lv_obj_set_height ( btn, 60 );
     lv_obj_set_width ( btn, 300 );
@@ -312,6 +336,19 @@ static void drawLabels()
     lv_obj_align ( version_label, LV_ALIGN_TOP_MID, 110, 0 );
     lv_obj_add_style ( version_label, &shaStyle, 0 );
 
+    // Speed and distance share the status bar with the version
+    spdLabel = lv_label_create ( lv_scr_act() );
+    distLabel = lv_label_create ( lv_scr_act() );
+    lv_obj_align ( spdLabel, LV_ALIGN_TOP_MID, -100, 0 );
+    lv_obj_add_style ( spdLabel, &shaStyle, 0 );
+    lv_obj_align ( distLabel, LV_ALIGN_TOP_MID, 5, 0 );
+    lv_obj_add_style ( distLabel, &shaStyle, 0 );
+
+    // Heart rate sits above the timer
+    hrLabel = lv_label_create ( lv_scr_act() );
+    lv_obj_align ( hrLabel, LV_ALIGN_TOP_MID, 0, 300 );
+    lv_obj_add_style ( hrLabel, &shaStyle, 0 );
+
     lv_label_set_text ( rpm_desc_label, "Rpm" );
     lv_label_set_text ( pwr_desc_label, "Watts" );
     lv_label_set_text ( inc_desc_label, "Incline" );
@@ -369,7 +406,6 @@ int initDisplay()
 
     // Semaphore default to taken
     bikeData.tgt_inc = 20;
-    resetTime();
     updateLabels ( bikeData );
 
     lv_obj_clear_flag ( lv_scr_act(), LV_OBJ_FLAG_SCROLLABLE );
@@ -392,7 +428,6 @@ static uint32_t reDrawDisplay()
 
     bool active = bikeData.act_rpm > 0;
     updateBacklight ( active );
-    updateStopwatch ( active );
     updateLabels ( bikeData );
 
     uint32_t ret = lv_task_handler();
@@ -0,0 +1,175 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dsp.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include "cycles.h"
+
+// Limit catch-up after a stalled loop to one full rolling window
+#define MAX_CATCHUP_TICKS DSP_PWR_ROLL_TAPS
+
+LOG_MODULE_REGISTER ( dsp );
+
+// 2nd order Butterworth low-pass, fc = 0.25 Hz at fs = 2 Hz
+static const int32_t CADENCE_COEFFS [5] = { DSP_Q31 ( 0.0976310729 ),
+                                            DSP_Q31 ( 0.1952621459 ),
+                                            DSP_Q31 ( 0.0976310729 ),
+                                            DSP_Q31 ( 0.9428090416 ),
+                                            DSP_Q31 ( -0.3333333333 ) };
+
+DSP_WINDOW_DEFINE ( pwr_3s, DSP_PWR_AVG_TAPS );
+DSP_WINDOW_DEFINE ( pwr_30s, DSP_PWR_ROLL_TAPS );
+static dsp_biquad_t cadence;
+static dsp_stats_t stats = {};
+static uint32_t last_tick_ms = 0;
+static bool started = false;
+
+void dsp_window_reset ( dsp_window_t *w )
+{
+    memset ( w->buf, 0, w->len * sizeof ( w->buf [0] ) );
+    w->pos = 0;
+    w->cnt = 0;
+    w->sum = 0;
+}
+
+void dsp_window_push ( dsp_window_t *w, uint16_t x )
+{
+    // O(1) regardless of length, subtract the oldest and add the newest
+    w->sum -= w->buf [w->pos];
+    w->sum += x;
+    w->buf [w->pos] = x;
+    if ( ++w->pos >= w->len ) {
+        w->pos = 0;
+    }
+    if ( w->cnt < w->len ) {
+        w->cnt++;
+    }
+}
+
+uint16_t dsp_window_mean ( const dsp_window_t *w )
+{
+    if ( !w->cnt ) {
+        return 0;
+    }
+    return ( w->sum + w->cnt / 2 ) / w->cnt;
+}
+
+// Clears the history, call once before the first sample
+void dsp_biquad_init ( dsp_biquad_t *f,
+                       const int32_t *coeffs,
+                       int8_t postShift )
+{
+    f->coeffs = coeffs;
+    f->postShift = postShift;
+    memset ( f->state, 0, sizeof ( f->state ) );
+#if defined( CONFIG_CMSIS_DSP )
+    arm_biquad_cascade_df1_init_q31 (
+        &f->inst, 1, ( q31_t * )coeffs, f->state, postShift );
+#endif
+}
+
+int32_t dsp_biquad_q31 ( dsp_biquad_t *f, int32_t x )
+{
+    int32_t y;
+#if defined( CONFIG_CMSIS_DSP )
+    arm_biquad_cascade_df1_q31 ( &f->inst, &x, &y, 1 );
+#else
+    // Scalar fallback, mirrors arm_biquad_cascade_df1_q31 bit for bit
+    int64_t acc;
+    acc = ( int64_t )f->coeffs [0] * x;
+    acc += ( int64_t )f->coeffs [1] * f->state [0];
+    acc += ( int64_t )f->coeffs [2] * f->state [1];
+    acc += ( int64_t )f->coeffs [3] * f->state [2];
+    acc += ( int64_t )f->coeffs [4] * f->state [3];
+    y = ( int32_t )( acc >> ( 31 - f->postShift ) );
+    f->state [1] = f->state [0];
+    f->state [0] = x;
+    f->state [3] = f->state [2];
+    f->state [2] = y;
+#endif
+    return y;
+}
+
+static void process_tick ( uint16_t watts, uint16_t rpm )
+{
+    uint64_t start_cyc = cyclesNow();
+    dsp_window_push ( &pwr_3s, watts );
+    dsp_window_push ( &pwr_30s, watts );
+    stats.window_last_cyc = cyclesSince ( start_cyc );
+    stats.window_max_cyc = MAX ( stats.window_max_cyc, stats.window_last_cyc );
+
+    start_cyc = cyclesNow();
+    dsp_biquad_q31 ( &cadence, ( int32_t )rpm << DSP_CADENCE_SHIFT );
+    stats.biquad_last_cyc = cyclesSince ( start_cyc );
+    stats.biquad_max_cyc = MAX ( stats.biquad_max_cyc, stats.biquad_last_cyc );
+    stats.samples++;
+}
+
+// Feed the latest sample, returns the number of filter ticks processed
+int dspUpdate ( uint16_t watts, uint16_t rpm, uint32_t now_ms )
+{
+    if ( !started ) {
+        dsp_biquad_init ( &cadence, CADENCE_COEFFS, 0 );
+        stats.cyc_hz = cyclesInit();
+        last_tick_ms = now_ms;
+        started = true;
+        process_tick ( watts, rpm );
+        return 1;
+    }
+
+    uint32_t ticks = ( now_ms - last_tick_ms ) / DSP_SAMPLE_MS;
+    last_tick_ms += ticks * DSP_SAMPLE_MS;
+    if ( ticks > MAX_CATCHUP_TICKS ) {
+        ticks = MAX_CATCHUP_TICKS;
+    }
+    for ( uint32_t i = 0; i < ticks; i++ ) {
+        process_tick ( watts, rpm );
+    }
+    return ticks;
+}
+
+uint16_t dspGetPower3s()
+{
+    return dsp_window_mean ( &pwr_3s );
+}
+
+uint16_t dspGetPower30s()
+{
+    return dsp_window_mean ( &pwr_30s );
+}
+
+uint16_t dspGetCadence()
+{
+    // Output of the last tick, rounded back to whole rpm
+    int32_t y = cadence.state [2];
+    if ( y <= 0 ) {
+        return 0;
+    }
+    return ( y + ( 1 << ( DSP_CADENCE_SHIFT - 1 ) ) ) >> DSP_CADENCE_SHIFT;
+}
+
+dsp_stats_t dspGetStats()
+{
+    return stats;
+}
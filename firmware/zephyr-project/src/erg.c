@@ -0,0 +1,99 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "erg.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "powerModel.h"
+
+LOG_MODULE_REGISTER ( erg );
+
+// Targets come from the system work queue, updates from the main loop
+static struct k_spinlock lock;
+static uint16_t tgt_watts = 0;
+static uint16_t out_mag = RES_MIN_MAG;
+static uint16_t last_ff_mag = RES_MIN_MAG;
+static bool retarget = false;
+
+static uint16_t clip_rpm ( uint16_t rpm )
+{
+    return rpm < ERG_MIN_RPM ? ERG_MIN_RPM : rpm;
+}
+
+// Start or retarget, res_mag is the magnitude currently applied
+void ergStart ( uint16_t watts, uint16_t res_mag )
+{
+    if ( watts < ERG_MIN_WATTS ) {
+        watts = ERG_MIN_WATTS;
+    } else if ( watts > ERG_MAX_WATTS ) {
+        watts = ERG_MAX_WATTS;
+    }
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    tgt_watts = watts;
+    out_mag = res_mag;
+    retarget = true;
+    k_spin_unlock ( &lock, key );
+    LOG_INF ( "ERG target: %u W", watts );
+}
+
+uint16_t ergGetTarget()
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    const uint16_t watts = tgt_watts;
+    k_spin_unlock ( &lock, key );
+    return watts;
+}
+
+// Call once per cadence sample, returns the magnitude to apply
+uint16_t ergUpdate ( uint16_t rpm )
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    const uint16_t ff_mag = pmResForWatts ( clip_rpm ( rpm ), tgt_watts );
+    if ( retarget ) {
+        // New target, the whole step goes through the rate limit
+        last_ff_mag = ff_mag;
+        retarget = false;
+    }
+
+    // Cadence changes move the output straight away (feed-forward), that
+    // part is what the inverse model predicts for the new cadence
+    int32_t mag = ( int32_t )out_mag + ( ( int32_t )ff_mag - last_ff_mag );
+    last_ff_mag = ff_mag;
+
+    // Anything left over is a target change, rate limit it
+    int32_t err = ( int32_t )ff_mag - mag;
+    if ( err > ERG_MAX_STEP ) {
+        err = ERG_MAX_STEP;
+    } else if ( err < -ERG_MAX_STEP ) {
+        err = -ERG_MAX_STEP;
+    }
+    mag += err;
+
+    if ( mag < RES_MIN_MAG ) {
+        mag = RES_MIN_MAG;
+    } else if ( mag > RES_MAX_MAG ) {
+        mag = RES_MAX_MAG;
+    }
+    out_mag = mag;
+    k_spin_unlock ( &lock, key );
+    return mag;
+}
@@ -28,22 +28,36 @@
 #include <zephyr/init.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
 #include <zephyr/types.h>
-#include <zephyr/kernel.h>
 
-#define TGT_CYCLE_MS 250
-#define STACKSIZE 512
-#define PRIORITY 7
-#define TX_BUF_SIZE 50
+#include "telemetry.h"
+#include "trace.h"
 
 // Globals
 LOG_MODULE_REGISTER ( fec );
-static K_SEM_DEFINE ( ble_init_ok, 1, 1 );
-static bike_data_t bikeData = {};
-static fec_page_request_t reqPageData = {};
-static fec_command_status_data_t commandStatus
-    = { 0x47, 0xFF, 0xFF, 0x00, 0x00000000, 0x00 };
 static set_targets_callback_t setTargetsCbFunc = NULL;
+static struct k_spinlock lock;
+
+// Written on the BT RX thread, handled on the system work queue
+static uint8_t cmd_page [FEC_PAGE_LEN];
+static uint16_t cmd_trace = 0;
+static uint8_t req_page = 0;
+static uint8_t req_left = 0;
+
+// Only touched from the system work queue
+static fec_command_status_data_t commandStatus
+    = { FEC_COMMAND_STATUS_PG, 0xFF, 0xFF, 0xFF, { 0xFF, 0xFF, 0xFF, 0xFF } };
+static uint32_t page_cnt = 0;
+static uint32_t next_ms = 0;
+static uint32_t last_revs = 0;
+static uint8_t evt_cnt = 0;
+static uint16_t acc_watts = 0;
+
+static void cmd_work_handler ( struct k_work *work );
+K_WORK_DEFINE ( cmd_work, cmd_work_handler );
+static void page_work_handler ( struct k_work *work );
+K_WORK_DELAYABLE_DEFINE ( page_work, page_work_handler );
 
 void fecSetTargetsCb ( set_targets_callback_t func )
 {
@@ -59,30 +73,26 @@ static void fec_notify_ccc_cfg_changed ( const struct bt_gatt_attr *attr,
     LOG_INF ( "FE-C notifications %s", notif_enabled ? "enabled" : "disabled" );
 }
 
-static uint8_t get_checksum ( uint8_t buf [], size_t len )
+// XOR of every byte before the checksum, sync included
+static uint8_t get_checksum ( const uint8_t buf [], size_t len )
 {
     uint8_t chkSum = 0;
-    for ( int i = 0; i < len - 1; i++ ) {  // TODO - Use the first byte?
+    for ( int i = 0; i < len - 1; i++ ) {
         chkSum ^= buf [i];
     }
     return chkSum;
 }
 
-static uint8_t check_checksum ( uint8_t buf [], size_t len )
-{
-    return buf [len - 1] - get_checksum ( buf, len );
-}
-
 static void incCmdSeq()
 {
-    if ( commandStatus.sequenceNum == 0xFE ) {
+    if ( commandStatus.sequenceNum >= 0xFE ) {
         commandStatus.sequenceNum = 0x00;
     } else {
         commandStatus.sequenceNum++;
     }
 }
 
-// TX callback
+// TX callback, runs on the BT RX thread so it only queues the page
 static ssize_t tx_cb ( struct bt_conn *conn,
                        const struct bt_gatt_attr *attr,
                        const void *buf,
@@ -90,102 +100,33 @@ static ssize_t tx_cb ( struct bt_conn *conn,
                        uint16_t offset,
                        uint8_t flags )
 {
-    LOG_INF ( "TX callback, length %u", len );
-    const tx_msg_t *msg = ( void * )( ( uint8_t * )buf + offset );
-
-    if ( check_checksum ( ( void * )msg, len ) ) {
+    const tx_msg_t *msg = buf;
+    if ( offset ) {
+        return BT_GATT_ERR ( BT_ATT_ERR_INVALID_OFFSET );
+    } else if ( len != FEC_MSG_LEN ) {
+        LOG_WRN ( "Message length wrong: %u!", len );
+        return BT_GATT_ERR ( BT_ATT_ERR_INVALID_ATTRIBUTE_LEN );
+    } else if ( msg->data [FEC_PAGE_LEN] != get_checksum ( buf, len ) ) {
         LOG_ERR ( "Message received with bad checksum!" );
-        return -1;
-    } else if ( len < sizeof ( tx_msg_t ) + 2 ) {
-        LOG_WRN ( "Message length too short: %u!", len );
-        return len;
+        return BT_GATT_ERR ( BT_ATT_ERR_VALUE_NOT_ALLOWED );
     }
 
     // First byte of every data page is page number
-    const uint8_t page = msg->data [0];
-    switch ( page ) {
-        case FEC_CONTROL_SET_BASIC_RESISTANCE_PG:
-            LOG_WRN ( "Basic resistance command received!" );
-            if ( len
-                 < sizeof ( tx_msg_t ) + sizeof ( fec_basic_res_control_t ) ) {
-                LOG_WRN ( "Basic resistance command length too short: %u!",
-                          len );
-                break;
-            }
-            const fec_basic_res_control_t *resCtrl = ( void * )&msg->data;
-            commandStatus.data [0] = 0xFF;
-            commandStatus.data [1] = 0xFF;
-            commandStatus.data [2] = 0xFF;
-            commandStatus.data [3] = resCtrl->resistance;
-            // TODO
-            // setTargetsCbFunc();
-            commandStatus.lastCmdId = FEC_CONTROL_SET_BASIC_RESISTANCE_PG;
-            incCmdSeq();
-            break;
-        case FEC_CONTROL_SET_TARGET_POWER_PG:
-            LOG_WRN ( "Target power command received!" );
-            if ( len
-                 < sizeof ( tx_msg_t ) + sizeof ( fec_target_pwr_control_t ) ) {
-                LOG_WRN ( "Target power command length too short: %u!", len );
-                break;
-            }
-            const fec_target_pwr_control_t *pwrCtrl = ( void * )&msg->data;
-            commandStatus.data [0] = 0xFF;
-            commandStatus.data [1] = 0xFF;
-            commandStatus.data [2] = pwrCtrl->tgtWatts & 0x00FF;
-            commandStatus.data [3] = pwrCtrl->tgtWatts >> 8;
-            // TODO
-            // setTargetsCbFunc();
-            commandStatus.lastCmdId = FEC_CONTROL_SET_TARGET_POWER_PG;
-            incCmdSeq();
-            break;
-        case FEC_CONTROL_SET_WIND_RESISTANCE_PG:
-            LOG_WRN ( "Wind simulation command received!" );
-            if ( len
-                 < sizeof ( tx_msg_t ) + sizeof ( fec_wind_res_control_t ) ) {
-                LOG_WRN ( "Wind simulation command length too short: %u!",
-                          len );
-                break;
-            }
-            const fec_wind_res_control_t *windCtrl = ( void * )&msg->data;
-            commandStatus.data [0] = 0xFF;
-            commandStatus.data [1] = windCtrl->Cw;
-            commandStatus.data [2] = windCtrl->wind_kph;
-            commandStatus.data [3] = windCtrl->draftFactor;
-            // TODO
-            // setTargetsCbFunc();
-            commandStatus.lastCmdId = FEC_CONTROL_SET_WIND_RESISTANCE_PG;
-            incCmdSeq();
-            break;
-        case FEC_CONTROL_SET_TRACK_RESISTANCE_PG:
-            LOG_WRN ( "Track simulation command received!" );
-            if ( len
-                 < sizeof ( tx_msg_t ) + sizeof ( fec_track_res_control_t ) ) {
-                LOG_WRN ( "Track simulation command length too short: %u!",
-                          len );
-                break;
-            }
-            const fec_track_res_control_t *trackCtrl = ( void * )&msg->data;
-            commandStatus.data [0] = 0xFF;
-            commandStatus.data [1] = trackCtrl->incline & 0x00FF;
-            commandStatus.data [2] = trackCtrl->incline >> 8;
-            commandStatus.data [3] = trackCtrl->Crr;
-            // TODO
-            // setTargetsCbFunc();
-            commandStatus.lastCmdId = FEC_CONTROL_SET_WIND_RESISTANCE_PG;
-            incCmdSeq();
-            break;
-        case FEC_REQUEST_DATA_PAGE_PG:
-            if ( len < sizeof ( tx_msg_t ) + sizeof ( fec_page_request_t ) ) {
-                LOG_WRN ( "Data page request length too short: %u!", len );
-                break;
-            }
-            memcpy ( &reqPageData, &msg->data, sizeof ( fec_page_request_t ) );
-            LOG_INF ( "Data page request: %02x!", reqPageData.reqPage );
-            break;
-        default:
-            LOG_WRN ( "Unknown data page: %02x!", page );
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( msg->data [0] == FEC_REQUEST_DATA_PAGE_PG ) {
+        const fec_page_request_t *req = ( const void * )msg->data;
+        if ( req->cmdType == FEC_REQUEST_DATA_PAGE ) {
+            req_page = req->reqPage;
+            req_left = req->reqCnt ? req->reqCnt : 1;
+        }
+    } else {
+        // A page not yet handled is overwritten, so is its trace
+        traceDrop ( cmd_trace );
+        cmd_trace = traceStart();
+        memcpy ( cmd_page, msg->data, FEC_PAGE_LEN );
+        k_work_submit ( &cmd_work );
     }
+    k_spin_unlock ( &lock, key );
 
     return len;
 }
@@ -209,358 +150,283 @@ BT_GATT_SERVICE_DEFINE (
                              tx_cb,
                              NULL ) );
 
-static int fec_init ( const struct device *dev )
+// Control pages, the command status page echoes the settings back
+static void cmd_work_handler ( struct k_work *work )
 {
-    ARG_UNUSED ( dev );
-
-    k_sem_give ( &ble_init_ok );
-
-    return 0;
-}
+    uint8_t page [FEC_PAGE_LEN];
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    memcpy ( page, cmd_page, sizeof ( page ) );
+    const uint16_t trace = cmd_trace;
+    cmd_trace = 0;
+    k_spin_unlock ( &lock, key );
+
+    bike_tgts_t tgts = BIKE_TGTS_NONE;
+    tgts.trace = trace;
+    uint8_t status = FEC_CMD_PASS;
+    switch ( page [0] ) {
+        case FEC_CONTROL_SET_BASIC_RESISTANCE_PG: {
+            const fec_basic_res_control_t *resCtrl = ( const void * )page;
+            tgts.resistance = resCtrl->resistance;  // 0.5%
+            break;
+        }
+        case FEC_CONTROL_SET_TARGET_POWER_PG: {
+            const fec_target_pwr_control_t *pwrCtrl = ( const void * )page;
+            tgts.power = pwrCtrl->tgtWatts / 4;  // 0.25 W
+            break;
+        }
+        case FEC_CONTROL_SET_WIND_RESISTANCE_PG: {
+            const fec_wind_res_control_t *windCtrl = ( const void * )page;
+            if ( windCtrl->Cw != 0xFF ) {
+                const uint8_t draft = ( windCtrl->draftFactor != 0xFF )
+                                          ? windCtrl->draftFactor
+                                          : 100;
+                tgts.cw = windCtrl->Cw * draft / 100;
+            }
+            if ( ( uint8_t )windCtrl->wind_kph != 0xFF ) {
+                tgts.wind = windCtrl->wind_kph * 2500 / 9;  // 0.001 m/s
+            }
+            break;
+        }
+        case FEC_CONTROL_SET_TRACK_RESISTANCE_PG: {
+            const fec_track_res_control_t *trackCtrl = ( const void * )page;
+            const uint16_t grade = sys_le16_to_cpu ( trackCtrl->incline );
+            if ( grade != 0xFFFF ) {
+                tgts.incline = grade - 20000;  // Offset by -200%
+            }
+            if ( trackCtrl->Crr != 0xFF ) {
+                tgts.crr = trackCtrl->Crr / 2;  // 0.00005 to 0.0001
+            }
+            break;
+        }
+        default:
+            LOG_WRN ( "Unknown data page: %02x!", page [0] );
+            status = FEC_CMD_NOT_SUPPORTED;
+    }
 
-void bt_fec_update ( bike_data_t data )
-{
-    bikeData = data;
+    if ( status == FEC_CMD_PASS ) {
+        if ( setTargetsCbFunc ) {
+            setTargetsCbFunc ( tgts );
+        } else {
+            LOG_ERR ( "Bike target callback not registered!" );
+        }
+    } else {
+        traceDrop ( trace );
+    }
+    commandStatus.lastCmdId = page [0];
+    commandStatus.cmdStatus = status;
+    memcpy ( commandStatus.data, &page [4], sizeof ( commandStatus.data ) );
+    incCmdSeq();
 }
 
-static void set_checksum ( uint8_t buf [], size_t len )
+// 8.5.2 General FE Data, times and distance roll over
+static void build_general_data ( const bike_data_t *data, uint8_t *buf )
 {
-    buf [len - 1] = get_checksum ( buf, len );
+    fec_general_fe_data_t *pg = ( void * )buf;
+    pg->equipment = STATIONARY_BIKE;
+    pg->elapsedTime = data->ride.elapsed_ms / 250;  // 0.25s
+    pg->distance = data->ride.distance_m;           // meters
+    pg->speed = sys_cpu_to_le16 ( data->speed_mmps );  // 0.001 m/s
+    pg->heartrate = ( data->heart_bpm && !( data->invalid & BIKE_SAMPLE_HR ) )
+                        ? data->heart_bpm
+                        : 0xFF;  // bpm
+    pg->capabilities = FEC_CAP_DISTANCE | FEC_CAP_VIRTUAL_SPEED;
+    pg->feState = FEC_STATE_IN_USE;
 }
 
-static size_t set_general_data_page ( void *buf )
+static void build_general_settings ( const bike_data_t *data, uint8_t *buf )
 {
-    static fec_general_fe_data_t data = {};
-    static const size_t msgSize
-        = sizeof ( tx_msg_t ) + sizeof ( fec_general_fe_data_t );
-    tx_msg_t *msg = buf;
-    if ( !msg ) {
-        LOG_ERR ( "set_general_data_page recieved null buffer!" );
-        return 0;
-    }
-    msg->sync = TX_SYNC;
-    msg->len = msgSize - 4;
-    msg->type = 0x4E;  // TODO - BROADCAST? No idea if this is right
-    msg->channel = TX_CHANNEL;
-
-    // Update bike data
-    data.page = FEC_GENERAL_FE_DATA_PG;
-    data.equipment = STATIONARY_BIKE;
-    data.elapsedTime += 5;  // 0.25s
-    data.distance += 1;     // meters
-    data.speed = 0xFFFF;    // 0.001 m/s
-    data.heartrate = 0xFF;  // bpm
-    data.capabilities = 0x00;
-    data.feState = 0x03;  // IN_USE
-
-    // Prep message
-    memcpy ( &msg->data, &data, sizeof ( fec_general_fe_data_t ) );
-    set_checksum ( ( void * )msg, msgSize );
-    return msgSize;
+    fec_general_settings_t *pg = ( void * )buf;
+    pg->reserved = 0xFFFF;
+    pg->cycleLen = 0xFF;
+    pg->incline = sys_cpu_to_le16 ( 50 * ( ( int16_t )data->tgt_inc - 20 ) );
+    pg->resistance
+        = ( data->disp_res <= 1 ) ? 0 : ( data->disp_res - 1 ) * 200 / 21;
+    pg->capabilities = 0x00;
+    pg->feState = FEC_STATE_IN_USE;
 }
 
-static size_t set_general_settings_page ( void *buf )
+// 8.6.4 Specific Trainer/Stationary Bike Data, one event per crank rev
+static void build_bike_data ( const bike_data_t *data, uint8_t *buf )
 {
-    static fec_general_settings_t data = {};
-    static const size_t msgSize
-        = sizeof ( tx_msg_t ) + sizeof ( fec_general_settings_t );
-    tx_msg_t *msg = buf;
-    if ( !msg ) {
-        LOG_ERR ( "set_general_data_page recieved null buffer!" );
-        return 0;
-    }
-    msg->sync = TX_SYNC;
-    msg->len = msgSize - 4;
-    msg->type = 0x4E;  // TODO - BROADCAST? No idea if this is right
-    msg->channel = TX_CHANNEL;
-
-    // Update settings data page
-    data.page = FEC_GENERAL_SETTINGS_PG;
-    data.reserved = 0xFFFF;
-    data.cycleLen = 0xFF;
-    data.incline = 50 * ( ( int16_t )bikeData.tgt_inc - 20 );
-    if ( bikeData.disp_res <= 1 ) {
-        data.resistance = 0;
+    const uint32_t revs = data->crank_revs - last_revs;
+    last_revs = data->crank_revs;
+    evt_cnt += revs;
+    acc_watts += revs * data->watts;
+
+    fec_bike_data_t *pg = ( void * )buf;
+    pg->cnt = evt_cnt;
+    pg->wattsTotal = sys_cpu_to_le16 ( acc_watts );
+    if ( data->invalid & BIKE_SAMPLE_RPM ) {
+        pg->rpm = 0xFF;  // Invalid
+        pg->wattsInst = 0xFFF;
     } else {
-        data.resistance = ( bikeData.disp_res - 1 ) * 200 / 21;
+        pg->rpm = data->act_rpm;
+        pg->wattsInst = data->watts;
     }
-    data.feState = 0x03;  // IN_USE
-
-    // Prep message
-    memcpy ( &msg->data, &data, sizeof ( fec_general_settings_t ) );
-    set_checksum ( ( void * )msg, msgSize );
-    return msgSize;
+    pg->trainStatus = 0x00;
+    pg->flags = 0x00;
+    pg->feState = FEC_STATE_IN_USE;
 }
 
-static size_t set_bike_data_page ( void *buf )
+static void build_command_status ( const bike_data_t *data, uint8_t *buf )
 {
-    static fec_bike_data_t data = {};
-    static const size_t msgSize
-        = sizeof ( tx_msg_t ) + sizeof ( fec_bike_data_t );
-    tx_msg_t *msg = buf;
-    if ( !msg ) {
-        LOG_ERR ( "set_broadcast_msg recieved null buffer!" );
-        return 0;
-    }
-    msg->sync = TX_SYNC;
-    msg->len = msgSize - 4;
-    msg->type = 0x4E;  // TODO - BROADCAST? No idea if this is right
-    msg->channel = TX_CHANNEL;
-
-    // Update bike data
-    data.page = FEC_STATIONARY_BIKE_DATA_PG;
-    data.cnt++;
-    data.rpm = bikeData.act_rpm;
-    data.wattsTotal += bikeData.watts;  // TODO
-    data.wattsInst = bikeData.watts;
-    data.trainStatus = 0x00;
-    data.flags = 0x00;
-    data.feState = 0x03;  // IN_USE
-
-    // Prep message
-    memcpy ( &msg->data, &data, sizeof ( fec_bike_data_t ) );
-    set_checksum ( ( void * )msg, msgSize );
-    return msgSize;
+    memcpy ( buf, &commandStatus, FEC_PAGE_LEN );
 }
 
-static size_t set_command_status_page ( void *buf )
+static void build_manufacturer_id ( const bike_data_t *data, uint8_t *buf )
 {
-    static const size_t msgSize
-        = sizeof ( tx_msg_t ) + sizeof ( fec_command_status_data_t );
-    tx_msg_t *msg = buf;
-    if ( !msg ) {
-        LOG_ERR ( "set_general_data_page recieved null buffer!" );
-        return 0;
-    }
-    msg->sync = TX_SYNC;
-    msg->len = msgSize - 4;
-    msg->type = 0x4E;  // TODO - BROADCAST? No idea if this is right
-    msg->channel = TX_CHANNEL;
-
-    // Prep message
-    memcpy ( &msg->data, &commandStatus, sizeof ( fec_command_status_data_t ) );
-    set_checksum ( ( void * )msg, msgSize );
-    return msgSize;
+    fec_manufacturer_id_data_t *pg = ( void * )buf;
+    pg->reserved = 0xFFFF;
+    pg->hwRev = 0x01;                           // TODO
+    pg->manId = sys_cpu_to_le16 ( 0x00FF );     // TODO - Development ID
+    pg->modelNum = sys_cpu_to_le16 ( 0x0001 );  // TODO
 }
 
-static size_t set_manufacturer_id_page ( void *buf )
+static void build_product_info ( const bike_data_t *data, uint8_t *buf )
 {
-    static fec_manufacturer_id_data_t data = {};
-    static const size_t msgSize
-        = sizeof ( tx_msg_t ) + sizeof ( fec_manufacturer_id_data_t );
-    tx_msg_t *msg = buf;
-    if ( !msg ) {
-        LOG_ERR ( "set_general_data_page recieved null buffer!" );
-        return 0;
-    }
-    msg->sync = TX_SYNC;
-    msg->len = msgSize - 4;
-    msg->type = 0x4E;  // TODO - BROADCAST? No idea if this is right
-    msg->channel = TX_CHANNEL;
-
-    // Update manufacturer id page
-    data.page = FEC_COMMON_MANUFACTURER_IDENT_PG;
-    data.reserved = 0xFFFF;
-    data.hwRev = 0x01;    // TODO
-    data.manId = 0x00FF;  // TODO - Development ID
-    data.modelNum = 0x1;  // TODO
-
-    // Prep message
-    memcpy ( &msg->data, &data, sizeof ( fec_manufacturer_id_data_t ) );
-    set_checksum ( ( void * )msg, msgSize );
-    return msgSize;
+    fec_product_info_data_t *pg = ( void * )buf;
+    pg->reserved = 0xFF;
+    pg->swRevSupp = 0xFF;        // Invalid
+    pg->swRev = 0x01;            // TODO
+    pg->serialNum = 0xFFFFFFFF;  // Invalid
 }
 
-static size_t set_product_info_page ( void *buf )
+static void build_capabilities ( const bike_data_t *data, uint8_t *buf )
 {
-    static fec_product_info_data_t data = {};
-    static const size_t msgSize
-        = sizeof ( tx_msg_t ) + sizeof ( fec_product_info_data_t );
-    tx_msg_t *msg = buf;
-    if ( !msg ) {
-        LOG_ERR ( "set_general_data_page recieved null buffer!" );
-        return 0;
-    }
-    msg->sync = TX_SYNC;
-    msg->len = msgSize - 4;
-    msg->type = 0x4E;  // TODO - BROADCAST? No idea if this is right
-    msg->channel = TX_CHANNEL;
-
-    // Update product info page
-    data.page = FEC_COMMON_PRODUCT_INFORMATION_PG;
-    data.reserved = 0xFF;
-    data.swRevSupp = 0xFF;        // Invalid
-    data.swRev = 0x01;            // TODO
-    data.serialNum = 0xFFFFFFFF;  // Invalid
-
-    // Prep message
-    memcpy ( &msg->data, &data, sizeof ( fec_product_info_data_t ) );
-    set_checksum ( ( void * )msg, msgSize );
-    return msgSize;
+    fec_capabilities_t *pg = ( void * )buf;
+    pg->reserved = 0xFFFFFFFF;
+    pg->maxResistance = 0xFFFF;
+    pg->capabilities = BIT ( RES_SUPPORT_BIT ) | BIT ( PWR_SUPPORT_BIT )
+                       | BIT ( SIM_SUPPORT_BIT );
 }
 
-static size_t set_capabilities_page ( void *buf )
+typedef struct
 {
-    static fec_capabilities_t data = {};
-    static const size_t msgSize
-        = sizeof ( tx_msg_t ) + sizeof ( fec_capabilities_t );
-    tx_msg_t *msg = buf;
-    if ( !msg ) {
-        LOG_ERR ( "set_capabilities_page recieved null buffer!" );
-        return 0;
-    }
-    msg->sync = TX_SYNC;
-    msg->len = msgSize - 4;
-    msg->type = 0x4E;  // TODO - BROADCAST? No idea if this is right
-    msg->channel = TX_CHANNEL;
-
-    // Update bike data
-    data.page = FEC_COMMON_FE_CAPABILITIES_PG;
-    data.reserved = 0xFFFFFFFF;
-    data.maxResistance = 0xFFFF;
-    data.capabilities = RES_SUPPORT_BIT | PWR_SUPPORT_BIT
-                        | SIM_SUPPORT_BIT;  // TODO - Remove Power?
-
-    // Prep message
-    memcpy ( &msg->data, &data, sizeof ( fec_capabilities_t ) );
-    set_checksum ( ( void * )msg, msgSize );
-    return msgSize;
-}
+    uint8_t page;
+    void ( *build ) ( const bike_data_t *data, uint8_t *buf );
+} fec_encoder_t;
+
+static const fec_encoder_t ENCODERS [] = {
+    { FEC_GENERAL_FE_DATA_PG, build_general_data },
+    { FEC_GENERAL_SETTINGS_PG, build_general_settings },
+    { FEC_STATIONARY_BIKE_DATA_PG, build_bike_data },
+    { FEC_COMMAND_STATUS_PG, build_command_status },
+    { FEC_COMMON_MANUFACTURER_IDENT_PG, build_manufacturer_id },
+    { FEC_COMMON_PRODUCT_INFORMATION_PG, build_product_info },
+    { FEC_COMMON_FE_CAPABILITIES_PG, build_capabilities },
+};
 
-static void send_pacer()
+/*
+ * 10.1.1 - Minimum Data Page Requirements
+ *     FEC_GENERAL_FE_DATA_PG: 2 Hz - 2x (consecutive) per sec or every 5th
+ *     FEC_GENERAL_SETTINGS_PG = 0.2 Hz - At least once every 20 messages
+ *     FEC_STATIONARY_BIKE_DATA_PG: 0.8 Hz - At least once every 5 messages
+ *     FEC_COMMAND_STATUS_PG: On request
+ *     FEC_COMMON_MANUFACTURER_IDENT_PG: 2x (consecutive) every 132 messages
+ *     FEC_COMMON_PRODUCT_INFORMATION_PG: 2x (consecutive) every 132
+ *         messages
+ *     FEC_COMMON_FE_CAPABILITIES_PG: On request
+ */
+static const uint8_t ROTATION [] = {
+    FEC_GENERAL_FE_DATA_PG,      FEC_GENERAL_FE_DATA_PG,
+    FEC_GENERAL_SETTINGS_PG,     FEC_STATIONARY_BIKE_DATA_PG,
+    FEC_STATIONARY_BIKE_DATA_PG, FEC_GENERAL_FE_DATA_PG,
+    FEC_GENERAL_FE_DATA_PG,      FEC_STATIONARY_BIKE_DATA_PG,
+    FEC_STATIONARY_BIKE_DATA_PG, FEC_STATIONARY_BIKE_DATA_PG,
+    FEC_GENERAL_FE_DATA_PG,      FEC_GENERAL_FE_DATA_PG,
+    FEC_STATIONARY_BIKE_DATA_PG, FEC_STATIONARY_BIKE_DATA_PG,
+    FEC_STATIONARY_BIKE_DATA_PG, FEC_GENERAL_FE_DATA_PG,
+    FEC_GENERAL_FE_DATA_PG,      FEC_STATIONARY_BIKE_DATA_PG,
+    FEC_STATIONARY_BIKE_DATA_PG, FEC_STATIONARY_BIKE_DATA_PG,
+};
+
+// In the first rotation of every common page interval these replace the
+// two general FE data pairs at slots 0-1 and 10-11. Settings stay once
+// every 20 messages and trainer data once every 5, general FE data has
+// one gap of 8 other messages in that rotation.
+static const uint8_t COMMON_PAGES [ARRAY_SIZE ( ROTATION )] = {
+    [0] = FEC_COMMON_MANUFACTURER_IDENT_PG,
+    [1] = FEC_COMMON_MANUFACTURER_IDENT_PG,
+    [10] = FEC_COMMON_PRODUCT_INFORMATION_PG,
+    [11] = FEC_COMMON_PRODUCT_INFORMATION_PG,
+};
+BUILD_ASSERT ( FEC_COMMON_PAGE_INTERVAL % ARRAY_SIZE ( ROTATION ) == 0 );
+
+// Requested pages take the slot and hold the rotation back by one
+// message each, otherwise the rotation does
+static uint8_t next_page()
 {
-    static uint32_t last_ms = 0;
-    int64_t elapsed_ms = k_uptime_get_32() - last_ms;
-    if ( elapsed_ms < 0 ) {
-        elapsed_ms += 1LL << 32;
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( req_left ) {
+        req_left--;
+        const uint8_t page = req_page;
+        k_spin_unlock ( &lock, key );
+        return page;
     }
-    if ( elapsed_ms < TGT_CYCLE_MS ) {
-        k_msleep ( TGT_CYCLE_MS - elapsed_ms );
+    k_spin_unlock ( &lock, key );
+
+    const uint32_t cnt = page_cnt++ % FEC_COMMON_PAGE_INTERVAL;
+    const uint8_t slot = cnt % ARRAY_SIZE ( ROTATION );
+    if ( ( cnt < ARRAY_SIZE ( ROTATION ) ) && COMMON_PAGES [slot] ) {
+        return COMMON_PAGES [slot];
     }
-    last_ms = k_uptime_get_32();
+    return ROTATION [slot];
 }
 
-static void send_msg ( void *buf, size_t len )
+static size_t build_msg ( uint8_t page, uint8_t *buf )
 {
-    send_pacer();
-    /*uint8_t dataPage;
-    memcpy ( &dataPage, ( uint8_t * )buf + 4, sizeof ( uint8_t ) );
-    LOG_INF ( "Transmitting data page: %02x", dataPage );*/
-    int rc = bt_gatt_notify_uuid ( NULL,
-                                   BLE_UUID_FEC_RX_CHAR,
-                                   fec_svc.attrs,
-                                   buf,
-                                   len );
-    if ( rc == -ENOTCONN ) {
-        // Do nothing
-    } else if ( rc < 0 ) {
-        LOG_ERR ( "Failed to transmit message, error: %d", rc );
+    for ( size_t i = 0; i < ARRAY_SIZE ( ENCODERS ); i++ ) {
+        if ( ENCODERS [i].page != page ) {
+            continue;
+        }
+
+        tx_msg_t *msg = ( void * )buf;
+        msg->sync = TX_SYNC;
+        msg->len = FEC_MSG_LEN - 4;
+        msg->type = TX_BROADCAST;
+        msg->channel = TX_CHANNEL;
+        msg->data [0] = page;
+        const bike_data_t data = telemetryGetSnapshot();
+        ENCODERS [i].build ( &data, msg->data );
+        buf [FEC_MSG_LEN - 1] = get_checksum ( buf, FEC_MSG_LEN );
+        return FEC_MSG_LEN;
     }
+    LOG_WRN ( "Unknown data page request: %02x!", page );
+    return 0;
 }
 
-static void bt_fec_notify()
+// Paced from an absolute schedule so the rate doesn't drift
+static void page_work_handler ( struct k_work *work )
 {
-    static uint8_t buf [TX_BUF_SIZE] = {};
-    int len = 0;
-    static int cnt = 0;
-    cnt++;
-
-    // First check for requests
-    for ( int i = 0; i < reqPageData.reqCnt; i++ ) {
-        switch ( reqPageData.reqPage ) {
-            case 0:
-                // Don't do anything, no request
-                break;
-            case FEC_GENERAL_FE_DATA_PG:
-                len = set_general_data_page ( &buf );
-                send_msg ( buf, len );
-                break;
-            case FEC_GENERAL_SETTINGS_PG:
-                len = set_general_settings_page ( &buf );
-                send_msg ( buf, len );
-                break;
-            case FEC_STATIONARY_BIKE_DATA_PG:
-                len = set_bike_data_page ( &buf );
-                send_msg ( buf, len );
-                break;
-            case FEC_COMMAND_STATUS_PG:
-                len = set_command_status_page ( &buf );
-                send_msg ( buf, len );
-                break;
-            case FEC_COMMON_MANUFACTURER_IDENT_PG:
-                len = set_manufacturer_id_page ( &buf );
-                send_msg ( buf, len );
-                break;
-            case FEC_COMMON_PRODUCT_INFORMATION_PG:
-                len = set_product_info_page ( &buf );
-                send_msg ( buf, len );
-                break;
-            case FEC_COMMON_FE_CAPABILITIES_PG:
-                len = set_capabilities_page ( &buf );
-                send_msg ( buf, len );
-                break;
-            default:
-                LOG_WRN ( "Unknown data page request: %02x!",
-                          reqPageData.reqPage );
+    uint8_t buf [FEC_MSG_LEN];
+    const size_t len = telemetryPaused() ? 0 : build_msg ( next_page(), buf );
+    if ( len ) {
+        int rc = bt_gatt_notify_uuid (
+            NULL, BLE_UUID_FEC_RX_CHAR, fec_svc.attrs, buf, len );
+        if ( rc && ( rc != -ENOTCONN ) ) {
+            LOG_ERR ( "Failed to transmit message, error: %d", rc );
         }
     }
-    memset ( &reqPageData, 0, sizeof ( fec_page_request_t ) );
-
-    /*
-     * 10.1.1 - Minimum Data Page Requirements
-     *     FEC_GENERAL_FE_DATA_PG: 2 Hz - 2x (consecutive) per sec or every 5th
-     *     FEC_GENERAL_SETTINGS_PG = 0.2 Hz - At least once every 20 messages
-     *     FEC_STATIONARY_BIKE_DATA_PG: 0.8 Hz - At least once every 5 messages
-     *     FEC_COMMAND_STATUS_PG: On request
-     *     FEC_COMMON_MANUFACTURER_IDENT_PG: 2x (consecutive) every 132 messages
-     *     FEC_COMMON_PRODUCT_INFORMATION_PG: 2x (consecutive) every 132
-     *         messages
-     *     FEC_COMMON_FE_CAPABILITIES_PG: On request
-     */
-    if ( cnt % 132 == 0 ) {
-        len = set_manufacturer_id_page ( &buf );
-        send_msg ( buf, len );
-        cnt++;
-        len = set_manufacturer_id_page ( &buf );
-        send_msg ( buf, len );
-        cnt++;
-        len = set_product_info_page ( &buf );
-        send_msg ( buf, len );
-        cnt++;
-        len = set_product_info_page ( &buf );
-        send_msg ( buf, len );
-    } else if ( cnt % 20 == 2 ) {
-        len = set_general_settings_page ( &buf );
-        send_msg ( buf, len );
-    } else if ( cnt % 5 == 0 ) {
-        len = set_general_data_page ( &buf );
-        send_msg ( buf, len );
-        cnt++;
-        len = set_general_data_page ( &buf );
-        send_msg ( buf, len );
-    } else {
-        len = set_bike_data_page ( &buf );
-        send_msg ( buf, len );
+
+    next_ms += FEC_PAGE_MS;
+    int32_t wait_ms = next_ms - k_uptime_get_32();
+    if ( wait_ms < 0 ) {
+        next_ms = k_uptime_get_32();
+        wait_ms = 0;
     }
+    k_work_schedule ( &page_work, K_MSEC ( wait_ms ) );
 }
 
-static void ble_fec_notify_thread ( void )
+static int fec_init ( const struct device *dev )
 {
-    k_sem_take ( &ble_init_ok, K_FOREVER );
+    ARG_UNUSED ( dev );
 
-    for ( ;; ) {
-        bt_fec_notify();
-    }
+    next_ms = k_uptime_get_32();
+    k_work_schedule ( &page_work, K_MSEC ( FEC_PAGE_MS ) );
+
+    LOG_INF ( "FE-C initialized" );
+
+    return 0;
 }
 
-/*K_THREAD_DEFINE ( ble_fec_notify_thread_id,
-                  STACKSIZE,
-                  ble_fec_notify_thread,
-                  NULL,
-                  NULL,
-                  NULL,
-                  PRIORITY,
-                  0,
-                  5000 );
-
-SYS_INIT ( fec_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY );*/
+SYS_INIT ( fec_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY );
@@ -26,18 +26,62 @@
 #include <zephyr/bluetooth/gatt.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/init.h>
+#include <zephyr/sys/byteorder.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/types.h>
 
-#define SEM_TIMEOUT K_MSEC ( 500 )
+#include "erg.h"
+#include "telemetry.h"
+#include "trace.h"
 
 LOG_MODULE_REGISTER ( ftms );
 static set_targets_callback_t setTargetsCbFunc = NULL;
 static bool ftms_bike_notify = false;
 static bool ftms_status_notify = false;
-static bool ftms_control_notify = false;
-K_SEM_DEFINE ( ftms_sem, 0, 1 );
+static bool ftms_training_notify = false;
+
+// Status events are queued from any context, including the button
+// interrupts, and notified in order from the system work queue
+typedef struct
+{
+    uint8_t len;
+    ftms_status_t status;
+} status_evt_t;
+
+static void status_work_handler ( struct k_work *work );
+static void training_work_handler ( struct k_work *work );
+K_MSGQ_DEFINE ( status_q, sizeof ( status_evt_t ), FTMS_STATUS_QUEUE, 4 );
+K_WORK_DEFINE ( status_work, status_work_handler );
+K_WORK_DEFINE ( training_work, training_work_handler );
+static atomic_t revoke_req = ATOMIC_INIT ( 0 );
+static atomic_t training = ATOMIC_INIT ( FTMS_TRAINING_MANUAL );
+
+// One control point procedure at a time (4.16.1), validated on the RX
+// thread and applied from the system work queue
+typedef struct
+{
+    struct bt_conn *conn;
+    const struct bt_gatt_attr *attr;
+    uint32_t rx_ms;
+    uint8_t req_op;
+    uint8_t result;
+    bike_tgts_t tgts;
+} ctrl_req_t;
+
+static void ctrl_work_handler ( struct k_work *work );
+K_WORK_DEFINE ( ctrl_work, ctrl_work_handler );
+static atomic_t ctrl_busy = ATOMIC_INIT ( 0 );
+static ctrl_req_t ctrl_req;
+static ctrl_point_resp_t ctrl_resp;
+static struct bt_gatt_indicate_params ctrl_ind;
+
+// Write to confirmed indication
+static uint32_t ctrl_lat_last_ms = 0;
+static uint32_t ctrl_lat_max_ms = 0;
+
+// Client allowed to steer, everyone else only receives telemetry
+static struct bt_conn *ctrl_owner = NULL;
 
 void ftmsSetTargetsCb ( set_targets_callback_t func )
 {
@@ -63,15 +107,54 @@ static void ftms_status_ccc_changed ( const struct bt_gatt_attr *attr,
               ftms_status_notify ? "enabled" : "disabled" );
 }
 
+static void ftms_training_ccc_changed ( const struct bt_gatt_attr *attr,
+                                        uint16_t value )
+{
+    ftms_training_notify = ( value == BT_GATT_CCC_NOTIFY );
+
+    LOG_INF ( "FTMS training status notifications %s",
+              ftms_training_notify ? "enabled" : "disabled" );
+}
+
 static void ftms_control_ccc_changed ( const struct bt_gatt_attr *attr,
                                        uint16_t value )
 {
-    ftms_control_notify = ( value == BT_GATT_CCC_NOTIFY );
+    LOG_INF ( "FTMS control point indications %s",
+              ( value == BT_GATT_CCC_INDICATE ) ? "enabled" : "disabled" );
+}
+
+// 4.16.2.1 Request Control, first client to ask or steer wins
+static bool has_control ( struct bt_conn *conn )
+{
+    if ( ctrl_owner == conn ) {
+        return true;
+    } else if ( ctrl_owner ) {
+        return false;
+    }
+    ctrl_owner = bt_conn_ref ( conn );
+    LOG_INF ( "Control granted to connection %u", bt_conn_index ( conn ) );
+    return true;
+}
+
+static void release_control()
+{
+    if ( ctrl_owner ) {
+        LOG_INF ( "Control released by connection %u",
+                  bt_conn_index ( ctrl_owner ) );
+        bt_conn_unref ( ctrl_owner );
+        ctrl_owner = NULL;
+    }
+}
 
-    LOG_INF ( "FTMS control point notifications %s",
-              ftms_control_notify ? "enabled" : "disabled" );
+static void disconnected ( struct bt_conn *conn, uint8_t reason )
+{
+    if ( conn == ctrl_owner ) {
+        release_control();
+    }
 }
 
+BT_CONN_CB_DEFINE ( ftms_conn_callbacks ) = { .disconnected = disconnected };
+
 static ble_ftms_features_t ftms_features;
 static ssize_t read_feat ( struct bt_conn *conn,
                            const struct bt_gatt_attr *attr,
@@ -120,68 +203,197 @@ static ssize_t read_res_range ( struct bt_conn *conn,
                                sizeof ( res_range_data ) );
 }
 
-static void control_response ( struct bt_conn *conn,
-                               const struct bt_gatt_attr *attr,
-                               uint8_t req_op,
-                               const void *data,
-                               uint16_t data_len );
-
-static ssize_t write_control ( struct bt_conn *conn,
+static ssize_t read_training ( struct bt_conn *conn,
                                const struct bt_gatt_attr *attr,
-                               const void *buf,
+                               void *buf,
                                uint16_t len,
-                               uint16_t offset,
-                               uint8_t flags )
+                               uint16_t offset )
+{
+    const ftms_training_t value = { .status = atomic_get ( &training ) };
+    return bt_gatt_attr_read (
+        conn, attr, buf, len, offset, &value, sizeof ( value ) );
+}
+
+static ble_ftms_power_range_data_t pwr_range_data;
+static ssize_t read_pwr_range ( struct bt_conn *conn,
+                                const struct bt_gatt_attr *attr,
+                                void *buf,
+                                uint16_t len,
+                                uint16_t offset )
 {
-    // Lock semaphore to prevent notifications before response
-    if ( k_sem_take ( &ftms_sem, SEM_TIMEOUT ) ) {
-        LOG_WRN ( "Failed to get FTMS semaphore!  Continuing anyways..." );
+    return bt_gatt_attr_read ( conn,
+                               attr,
+                               buf,
+                               len,
+                               offset,
+                               &pwr_range_data,
+                               sizeof ( pwr_range_data ) );
+}
+
+static void ctrl_indicated ( struct bt_conn *conn,
+                             struct bt_gatt_indicate_params *params,
+                             uint8_t err )
+{
+    ctrl_lat_last_ms = k_uptime_get_32() - ctrl_req.rx_ms;
+    if ( ctrl_lat_last_ms > ctrl_lat_max_ms ) {
+        ctrl_lat_max_ms = ctrl_lat_last_ms;
     }
+    LOG_INF ( "Opcode %x result %x confirmed in %u ms (max %u, err %u)",
+              ctrl_resp.req_op,
+              ctrl_resp.result,
+              ctrl_lat_last_ms,
+              ctrl_lat_max_ms,
+              err );
+}
 
-    const ctrl_point_req_t *req = buf;
-    if ( offset ) {
-        k_sem_give ( &ftms_sem );
-        return BT_GATT_ERR ( BT_ATT_ERR_INVALID_OFFSET );
+static void ctrl_done ( struct bt_gatt_indicate_params *params )
+{
+    bt_conn_unref ( ctrl_req.conn );
+    ctrl_req.conn = NULL;
+    atomic_clear ( &ctrl_busy );
+}
+
+// 4.16.2.22 Procedure Complete, sent once the targets are in place
+static void ctrl_work_handler ( struct k_work *work )
+{
+    if ( ctrl_req.result == OPCODE_SUCCESS ) {
+        if ( setTargetsCbFunc ) {
+            setTargetsCbFunc ( ctrl_req.tgts );
+        } else {
+            LOG_ERR ( "Bike target callback not registered!" );
+            ctrl_req.result = OPCODE_FAILED;
+        }
+    }
+
+    ctrl_resp.resp_op = OPCODE_RESPONSE;
+    ctrl_resp.req_op = ctrl_req.req_op;
+    ctrl_resp.result = ctrl_req.result;
+
+    memset ( &ctrl_ind, 0, sizeof ( ctrl_ind ) );
+    ctrl_ind.attr = ctrl_req.attr;
+    ctrl_ind.func = ctrl_indicated;
+    ctrl_ind.destroy = ctrl_done;
+    ctrl_ind.data = &ctrl_resp;
+    ctrl_ind.len = sizeof ( ctrl_resp );
+    int err = bt_gatt_indicate ( ctrl_req.conn, &ctrl_ind );
+    if ( err ) {
+        LOG_WRN ( "Control point indication failed (err %d)", err );
+        ctrl_done ( &ctrl_ind );
     }
-    const uint16_t data_len = len - sizeof ( ctrl_point_req_t );
+}
 
+// Fills in the targets, returns the result code for the response
+static uint8_t parse_control ( const ctrl_point_req_t *req,
+                               uint16_t data_len,
+                               bike_tgts_t *tgts )
+{
     switch ( req->req_op ) {
         case OPCODE_REQUEST:
         case OPCODE_RESET:
-        case OPCODE_SET_INC:
-        case OPCODE_SET_RES:
         case OPCODE_START:
-            control_response ( conn, attr, req->req_op, &req->param, data_len );
-            break;
+            return OPCODE_SUCCESS;
+        case OPCODE_SET_INC: {
+            // 4.16.2.4 Set Target Inclination Procedure
+            if ( data_len != sizeof ( int16_t ) ) {
+                return OPCODE_INVALID_PARAM;
+            }
+            int16_t tenth_pct = sys_get_le16 ( req->param );
+            if ( ( tenth_pct < inc_range_data.min_tenth_pct )
+                 || ( tenth_pct > inc_range_data.max_tenth_pct ) ) {
+                return OPCODE_INVALID_PARAM;
+            }
+            tgts->incline = tenth_pct * 10;
+            return OPCODE_SUCCESS;
+        }
+        case OPCODE_SET_RES:
+            // 4.16.2.5 Set Target Resistance Level Procedure
+            if ( data_len != sizeof ( uint8_t ) ) {
+                return OPCODE_INVALID_PARAM;
+            }
+            tgts->resistance = req->param [0];
+            return OPCODE_SUCCESS;
+        case OPCODE_SET_PWR: {
+            // 4.16.2.7 Set Target Power Procedure
+            if ( data_len != sizeof ( int16_t ) ) {
+                LOG_ERR ( "Wrong length for target power!" );
+                return OPCODE_INVALID_PARAM;
+            }
+            int16_t watts = sys_get_le16 ( req->param );
+            if ( ( watts < pwr_range_data.min_watts )
+                 || ( watts > pwr_range_data.max_watts ) ) {
+                return OPCODE_INVALID_PARAM;
+            }
+            tgts->power = watts;
+            return OPCODE_SUCCESS;
+        }
         case OPCODE_SIM_PARAMS: {
             if ( data_len != sizeof ( sim_data_param_t ) ) {
-                LOG_ERR ( "Wrong length for bike sim parameters!\n" );
-                break;
-            }
-            sim_data_param_t *sim_data = ( void * )&req->param;
-            /*LOG_INF ( "Params: %d,%d,%u,%u",
-                      sim_data->wind_mps,
-                      sim_data->grade_hundredths_pct,
-                      sim_data->Crr,
-                      sim_data->Cw );*/
-            bike_tgts_t tgts = { sim_data->grade_hundredths_pct, 0xFF };
-            if ( setTargetsCbFunc ) {
-                setTargetsCbFunc ( tgts );
-            } else {
-                LOG_ERR ( "Bike target callback not registered!" );
+                LOG_ERR ( "Wrong length for bike sim parameters!" );
+                return OPCODE_INVALID_PARAM;
             }
-            control_response ( conn, attr, req->req_op, &req->param, data_len );
-            break;
+            const sim_data_param_t *sim_data = ( const void * )req->param;
+            tgts->incline = sim_data->grade_hundredths_pct;
+            tgts->wind = sim_data->wind_mps;
+            tgts->crr = sim_data->Crr;
+            tgts->cw = sim_data->Cw;
+            return OPCODE_SUCCESS;
         }
         default:
-            LOG_WRN ( "Unknown opcode: %x!\n", req->req_op );
-            // TODO - Return failure
-            control_response ( conn, attr, req->req_op, &req->param, data_len );
+            LOG_WRN ( "Unknown opcode: %x!", req->req_op );
+            return OPCODE_NOT_SUPPORTED;
     }
+}
 
-    // Give up semaphore
-    k_sem_give ( &ftms_sem );
+// Runs on the BT RX thread, so nothing here may block
+static ssize_t write_control ( struct bt_conn *conn,
+                               const struct bt_gatt_attr *attr,
+                               const void *buf,
+                               uint16_t len,
+                               uint16_t offset,
+                               uint8_t flags )
+{
+    const ctrl_point_req_t *req = buf;
+    if ( offset ) {
+        return BT_GATT_ERR ( BT_ATT_ERR_INVALID_OFFSET );
+    } else if ( len < sizeof ( ctrl_point_req_t ) ) {
+        return BT_GATT_ERR ( BT_ATT_ERR_INVALID_ATTRIBUTE_LEN );
+    } else if ( !bt_gatt_is_subscribed ( conn, attr, BT_GATT_CCC_INDICATE ) ) {
+        return BT_GATT_ERR ( BT_ATT_ERR_CCC_IMPROPER_CONF );
+    } else if ( !atomic_cas ( &ctrl_busy, 0, 1 ) ) {
+        return BT_GATT_ERR ( BT_ATT_ERR_PROCEDURE_IN_PROGRESS );
+    }
+
+    ctrl_req.conn = bt_conn_ref ( conn );
+    ctrl_req.attr = attr;
+    ctrl_req.rx_ms = k_uptime_get_32();
+    ctrl_req.req_op = req->req_op;
+    ctrl_req.tgts = ( bike_tgts_t )BIKE_TGTS_NONE;
+
+    if ( !has_control ( conn ) ) {
+        LOG_WRN ( "Opcode %x rejected, another client has control",
+                  req->req_op );
+        ctrl_req.result = OPCODE_NOT_PERMITTED;
+    } else {
+        ctrl_req.result = parse_control (
+            req, len - sizeof ( ctrl_point_req_t ), &ctrl_req.tgts );
+    }
+
+    // Only target changes end up on the bus
+    if ( ( ctrl_req.result == OPCODE_SUCCESS )
+         && ( ( req->req_op == OPCODE_SET_INC )
+              || ( req->req_op == OPCODE_SET_RES )
+              || ( req->req_op == OPCODE_SET_PWR )
+              || ( req->req_op == OPCODE_SIM_PARAMS ) ) ) {
+        ctrl_req.tgts.trace = traceStart();
+    }
+
+    // The response still goes to this client after control is dropped
+    if ( ( req->req_op == OPCODE_RESET )
+         && ( ctrl_req.result == OPCODE_SUCCESS ) ) {
+        release_control();
+    }
 
+    k_work_submit ( &ctrl_work );
     return len;
 }
 
@@ -203,6 +415,14 @@ BT_GATT_SERVICE_DEFINE (
                              NULL ),
     BT_GATT_CCC ( ftms_bike_data_ccc_changed,
                   ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_TRAINING_STATUS_CHAR,
+                             BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+                             BT_GATT_PERM_READ,
+                             read_training,
+                             NULL,
+                             NULL ),
+    BT_GATT_CCC ( ftms_training_ccc_changed,
+                  ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ),
     BT_GATT_CHARACTERISTIC ( BLUE_UUID_SUPPORTED_INCLINATION_RANGE_CHAR,
                              BT_GATT_CHRC_READ,
                              BT_GATT_PERM_READ,
@@ -215,8 +435,14 @@ BT_GATT_SERVICE_DEFINE (
                              read_res_range,
                              NULL,
                              NULL ),
+    BT_GATT_CHARACTERISTIC ( BLUE_UUID_SUPPORTED_POWER_RANGE_CHAR,
+                             BT_GATT_CHRC_READ,
+                             BT_GATT_PERM_READ,
+                             read_pwr_range,
+                             NULL,
+                             NULL ),
     BT_GATT_CHARACTERISTIC ( BLUE_UUID_FITNESS_CONTROL_POINT_CHAR,
-                             BT_GATT_CHRC_WRITE | BT_GATT_CHRC_NOTIFY,
+                             BT_GATT_CHRC_WRITE | BT_GATT_CHRC_INDICATE,
                              BT_GATT_PERM_WRITE,
                              NULL,
                              write_control,
@@ -232,115 +458,350 @@ BT_GATT_SERVICE_DEFINE (
     BT_GATT_CCC ( ftms_status_ccc_changed,
                   ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ), );
 
-static void control_response ( struct bt_conn *conn,
-                               const struct bt_gatt_attr *attr,
-                               uint8_t req_op,
-                               const void *data,
-                               uint16_t data_len )
+// 4.9.1 Indoor Bike Data field, written little endian
+typedef struct
 {
-    if ( !ftms_bike_notify ) {
-        LOG_ERR ( "Control point notifications not enabled!" );
-        return;
+    uint16_t flag;
+    uint8_t size;
+    uint64_t ( *get ) ( const bike_data_t *data );
+} ibd_field_t;
+
+static uint64_t ibd_speed ( const bike_data_t *data )
+{
+    return ( data->speed_mmps * 36UL + 50 ) / 100;  // 0.01 km/h
+}
+
+static uint64_t ibd_avg_speed ( const bike_data_t *data )
+{
+    if ( !data->ride.elapsed_ms ) {
+        return 0;
     }
+    return ( uint64_t )data->ride.distance_m * 360000 / data->ride.elapsed_ms;
+}
+
+static uint64_t ibd_cadence ( const bike_data_t *data )
+{
+    return 2 * data->act_rpm;  // 0.5 rpm
+}
+
+static uint64_t ibd_avg_cadence ( const bike_data_t *data )
+{
+    return 2 * data->ride.avg_rpm;
+}
+
+static uint64_t ibd_distance ( const bike_data_t *data )
+{
+    return MIN ( data->ride.distance_m, 0xFFFFFF );
+}
+
+static uint64_t ibd_resistance ( const bike_data_t *data )
+{
+    return data->disp_res;
+}
+
+static uint64_t ibd_power ( const bike_data_t *data )
+{
+    return data->watts;
+}
 
-    ctrl_point_resp_t *resp;
-    uint8_t buf [sizeof ( ctrl_point_resp_t ) + data_len];
+static uint64_t ibd_avg_power ( const bike_data_t *data )
+{
+    return data->ride.avg_watts;
+}
 
-    resp = ( void * )buf;
-    resp->resp_op = OPCODE_RESPONSE;
-    resp->req_op = req_op;
-    resp->result = OPCODE_SUCCESS;
-    if ( data && data_len ) {
-        memcpy ( &resp->param, data, data_len );
+// Total, per hour and per minute in kcal of work done
+static uint64_t ibd_energy ( const bike_data_t *data )
+{
+    const uint64_t total = MIN ( data->ride.energy_j / 4184, 0xFFFE );
+    const uint64_t per_hour = data->watts * 3600UL / 4184;
+    const uint64_t per_min = data->watts * 60UL / 4184;
+    return total | ( per_hour << 16 ) | ( per_min << 32 );
+}
+
+static uint64_t ibd_elapsed ( const bike_data_t *data )
+{
+    return MIN ( data->ride.elapsed_ms / 1000, 0xFFFF );
+}
+
+// Spec order, speed is only present while More Data is clear
+static const ibd_field_t IBD_FIELDS [] = {
+    { 0, 2, ibd_speed },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_SPEED_PRESENT, 2, ibd_avg_speed },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_CADENCE_PRESENT,
+      2,
+      ibd_cadence },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_CADENCE_PRESENT,
+      2,
+      ibd_avg_cadence },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_TOTAL_DISTANCE_PRESENT, 3, ibd_distance },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_RESISTANCE_LEVEL_PRESENT,
+      2,
+      ibd_resistance },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_POWER_PRESENT, 2, ibd_power },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_AVERAGE_POWER_PRESENT, 2, ibd_avg_power },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_EXPENDED_ENERGY_PRESENT, 5, ibd_energy },
+    { BLE_FTMS_INDOOR_FLAGS_FIELD_ELAPSED_TIME_PRESENT, 2, ibd_elapsed },
+};
+
+static bool ibd_enabled ( const ibd_field_t *field )
+{
+    return !( field->flag & ~FTMS_BIKE_DATA_FIELDS );
+}
+
+// Readings flagged invalid are left out rather than sent as if live
+static bool ibd_valid ( const bike_data_t *data, const ibd_field_t *field )
+{
+    const uint16_t from_rpm
+        = BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_CADENCE_PRESENT
+          | BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_POWER_PRESENT;
+    return !( data->invalid & BIKE_SAMPLE_RPM ) || !( field->flag & from_rpm );
+}
+
+// Length of the whole record in one notification
+static size_t ibd_full_len()
+{
+    size_t len = sizeof ( uint16_t );
+    for ( size_t i = 0; i < ARRAY_SIZE ( IBD_FIELDS ); i++ ) {
+        if ( ibd_enabled ( &IBD_FIELDS [i] ) ) {
+            len += IBD_FIELDS [i].size;
+        }
+    }
+    return len;
+}
+
+// First field left for the final notification when the record is split
+static size_t ibd_split ( size_t len )
+{
+    size_t n = sizeof ( uint16_t );
+    size_t i = 1;
+    for ( ; i < ARRAY_SIZE ( IBD_FIELDS ); i++ ) {
+        if ( !ibd_enabled ( &IBD_FIELDS [i] ) ) {
+            continue;
+        } else if ( n + IBD_FIELDS [i].size > len ) {
+            break;
+        }
+        n += IBD_FIELDS [i].size;
+    }
+    return i;
+}
+
+static size_t ibd_put_field ( const bike_data_t *data,
+                              const ibd_field_t *field,
+                              uint8_t *buf,
+                              size_t n )
+{
+    uint64_t val = field->get ( data );
+    for ( uint8_t b = 0; b < field->size; b++ ) {
+        buf [n++] = val & 0xFF;
+        val >>= 8;
     }
-    bt_gatt_notify_uuid ( conn,
-                          BLUE_UUID_FITNESS_CONTROL_POINT_CHAR,
-                          attr,
-                          buf,
-                          sizeof ( buf ) );
+    return n;
 }
 
+// Writes the flags, speed if asked for and the fields in [from, to)
+static size_t ibd_put ( const bike_data_t *data,
+                        uint8_t *buf,
+                        size_t len,
+                        bool speed,
+                        size_t from,
+                        size_t to )
+{
+    uint16_t flags = speed ? 0 : BLE_FTMS_INDOOR_FLAGS_MORE_DATA;
+    size_t n = sizeof ( flags );
+    if ( speed ) {
+        n = ibd_put_field ( data, &IBD_FIELDS [0], buf, n );
+    }
+    for ( size_t i = from; i < to; i++ ) {
+        const ibd_field_t *field = &IBD_FIELDS [i];
+        if ( !ibd_enabled ( field ) || !ibd_valid ( data, field )
+             || ( n + field->size > len ) ) {
+            continue;
+        }
+        n = ibd_put_field ( data, field, buf, n );
+        flags |= field->flag;
+    }
+    sys_put_le16 ( flags, buf );
+    return n;
+}
+
+// 4.9.2.1 Leading part of a split record, nothing when it fits whole
+static size_t encode_more_data ( const bike_data_t *bikeData,
+                                 uint8_t *buf,
+                                 size_t len )
+{
+    if ( ibd_full_len() <= len ) {
+        return 0;
+    }
+    return ibd_put ( bikeData, buf, len, false, 1, ibd_split ( len ) );
+}
+
+// The whole record, or the rest of it with the speed field
+static size_t encode_bike_data ( const bike_data_t *bikeData,
+                                 uint8_t *buf,
+                                 size_t len )
+{
+    const size_t from = ( ibd_full_len() <= len ) ? 1 : ibd_split ( len );
+    return ibd_put (
+        bikeData, buf, len, true, from, ARRAY_SIZE ( IBD_FIELDS ) );
+}
+
+// Registered first, so it is queued ahead of the speed part
+static telemetry_chan_t more_data_chan = {
+    .name = "ftms+",
+    .encode = encode_more_data,
+    .period_ms = FTMS_DATA_PERIOD_MS,
+};
+
+static telemetry_chan_t bike_data_chan = {
+    .name = "ftms",
+    .encode = encode_bike_data,
+    .period_ms = FTMS_DATA_PERIOD_MS,
+};
+
 static int ftms_init ( const struct device *dev )
 {
     ARG_UNUSED ( dev );
 
     memset ( &ftms_features, 0, sizeof ( ftms_features ) );
     ftms_features.feat_blsc
-        = BLE_FTMS_FEATURE_CADENCE_SUPPORTED_BIT
+        = BLE_FTMS_FEATURE_AVERAGE_SPEED_SUPPORTED_BIT
+          | BLE_FTMS_FEATURE_CADENCE_SUPPORTED_BIT
+          | BLE_FTMS_FEATURE_TOTAL_DISTANCE_SUPPORTED_BIT
+          | BLE_FTMS_FEATURE_RESISTANCE_LEVEL_SUPPORTED_BIT
+          | BLE_FTMS_FEATURE_EXPENDED_ENERGY_SUPPORTED_BIT
+          | BLE_FTMS_FEATURE_ELAPSED_TIME_SUPPORTED_BIT
           | BLE_FTMS_FEATURE_POWER_MEASUREMENT_SUPPORTED_BIT;
 
     ftms_features.tgt_blsc = BLE_FTMS_TARGET_INCLINATION_SUPPORTED_BIT
                              | BLE_FTMS_TARGET_RESISTANCE_SUPPORTED_BIT
+                             | BLE_FTMS_TARGET_POWER_SUPPORTED_BIT
                              | BLE_FTMS_BIKE_SIMULATION_SUPPORTED_BIT;
 
-    inc_range_data.inc_tenth_pct = 5;
-    inc_range_data.max_tenth_pct = 200;
-    inc_range_data.min_tenth_pct = -100;
+    inc_range_data.inc_tenth_pct = FTMS_INC_STEP_TENTH_PCT;
+    inc_range_data.max_tenth_pct = FTMS_INC_MAX_TENTH_PCT;
+    inc_range_data.min_tenth_pct = FTMS_INC_MIN_TENTH_PCT;
 
     res_range_data.inc_cnt = 1;
     res_range_data.max_cnt = 22;
     res_range_data.min_cnt = 1;
 
+    pwr_range_data.min_watts = ERG_MIN_WATTS;
+    pwr_range_data.max_watts = ERG_MAX_WATTS;
+    pwr_range_data.inc_watts = ERG_INC_WATTS;
+
+    int err = telemetryRegister (
+        &more_data_chan, &ftms_svc, BLE_UUID_INDOOR_BIKE_DATA_CHAR );
+    if ( err ) {
+        return err;
+    }
+    err = telemetryRegister (
+        &bike_data_chan, &ftms_svc, BLE_UUID_INDOOR_BIKE_DATA_CHAR );
+    if ( err ) {
+        return err;
+    }
+
     LOG_INF ( "FTMS initialized" );
 
     return 0;
 }
 
-int bt_ftms_bike_notify ( bike_data_t bikeData )
+static void notify_all ( const struct bt_uuid *uuid,
+                         const void *data,
+                         uint16_t len )
 {
-    if ( !ftms_bike_notify ) {
-        return -EACCES;
+    int err = bt_gatt_notify_uuid ( NULL, uuid, ftms_svc.attrs, data, len );
+    if ( err && ( err != -ENOTCONN ) ) {
+        LOG_WRN ( "Status notification failed (err %d)", err );
     }
+}
 
-    // Lock semaphore
-    if ( k_sem_take ( &ftms_sem, SEM_TIMEOUT ) ) {
-        LOG_WRN ( "Failed to get FTMS semaphore!  Continuing anyways..." );
+// Safe from any context, dropped when nobody listens
+static void queue_status ( uint8_t op, const uint8_t *param, uint8_t len )
+{
+    if ( !ftms_status_notify ) {
+        return;
     }
+    status_evt_t evt = { .len = sizeof ( op ) + len, .status.op = op };
+    if ( len ) {
+        memcpy ( evt.status.param, param, len );
+    }
+    if ( k_msgq_put ( &status_q, &evt, K_NO_WAIT ) ) {
+        LOG_WRN ( "Status queue full, op %x dropped", op );
+        return;
+    }
+    k_work_submit ( &status_work );
+}
 
-    static ble_ftms_indoor_bike_data_t data = {};
-    data.flags = BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_CADENCE_PRESENT
-                 | BLE_FTMS_INDOOR_FLAGS_FIELD_INSTANTANEOUS_POWER_PRESENT;
-    data.InstantaneousCadence = 2 * bikeData.act_rpm;
-    data.InstantaneousPower = bikeData.watts;
-
-    int rc;
-    rc = bt_gatt_notify_uuid ( NULL,
-                               BLE_UUID_INDOOR_BIKE_DATA_CHAR,
-                               ftms_svc.attrs,
-                               &data,
-                               sizeof ( data ) );
-
-    // Give up semaphore
-    k_sem_give ( &ftms_sem );
+static void status_work_handler ( struct k_work *work )
+{
+    // Dropped here rather than by the caller, which may be an interrupt
+    if ( atomic_cas ( &revoke_req, 1, 0 ) && ctrl_owner ) {
+        release_control();
+        queue_status ( FTMS_STATUS_CTRL_LOST, NULL, 0 );
+    }
 
-    return rc == -ENOTCONN ? 0 : rc;
+    status_evt_t evt;
+    while ( !k_msgq_get ( &status_q, &evt, K_NO_WAIT ) ) {
+        notify_all ( BLE_UUID_FTMS_STATUS_CHAR, &evt.status, evt.len );
+    }
 }
 
-int bt_ftms_status_notify()
+static void training_work_handler ( struct k_work *work )
 {
-    if ( !ftms_status_notify ) {
-        return -EACCES;
+    if ( ftms_training_notify ) {
+        const ftms_training_t value = { .status = atomic_get ( &training ) };
+        notify_all ( BLE_UUID_TRAINING_STATUS_CHAR, &value, sizeof ( value ) );
     }
+}
 
-    // Lock semaphore
-    if ( k_sem_take ( &ftms_sem, SEM_TIMEOUT ) ) {
-        LOG_WRN ( "Failed to get FTMS semaphore!  Continuing anyways..." );
+// 4.17 Targets as applied, resistance is the level in the supported range
+void ftmsStatusTargets ( const bike_tgts_t tgts )
+{
+    uint8_t param [FTMS_STATUS_MAX_PARAM];
+    if ( ( tgts.wind != 0x7FFF ) || ( tgts.crr != 0xFF )
+         || ( tgts.cw != 0xFF ) ) {
+        sys_put_le16 ( tgts.wind, &param [0] );
+        sys_put_le16 ( tgts.incline, &param [2] );
+        param [4] = tgts.crr;
+        param [5] = tgts.cw;
+        queue_status ( FTMS_STATUS_SIM_PARAMS, param, 6 );
+    } else if ( tgts.incline != 0x7FFF ) {
+        sys_put_le16 ( tgts.incline / 10, param );  // 0.1%
+        queue_status ( FTMS_STATUS_TGT_INC, param, sizeof ( int16_t ) );
     }
+    if ( tgts.resistance != 0xFF ) {
+        param [0] = tgts.resistance;
+        queue_status ( FTMS_STATUS_TGT_RES, param, sizeof ( uint8_t ) );
+    }
+    if ( tgts.power != 0xFFFF ) {
+        sys_put_le16 ( tgts.power, param );
+        queue_status ( FTMS_STATUS_TGT_PWR, param, sizeof ( int16_t ) );
+    }
+}
 
-    int rc;
-    ftms_status_t status = {};
-    status.op = OPCODE_STARTED;
-
-    rc = bt_gatt_notify_uuid ( NULL,
-                               BLE_UUID_FTMS_STATUS_CHAR,
-                               ftms_svc.attrs,
-                               &status,
-                               sizeof ( status ) );  // TODO - Size is wrong!
+// Started or stopped from the bike itself
+void ftmsStatusUser ( bool started )
+{
+    if ( started ) {
+        queue_status ( FTMS_STATUS_STARTED, NULL, 0 );
+    } else {
+        const uint8_t param = FTMS_STATUS_PARAM_STOP;
+        queue_status ( FTMS_STATUS_STOPPED, &param, sizeof ( param ) );
+    }
+}
 
-    // Give up semaphore
-    k_sem_give ( &ftms_sem );
+// The rider took over locally, the app has to request control again
+void ftmsRevokeControl()
+{
+    atomic_set ( &revoke_req, 1 );
+    k_work_submit ( &status_work );
+}
 
-    return rc == -ENOTCONN ? 0 : rc;
+void ftmsTrainingStatus ( uint8_t status )
+{
+    if ( atomic_set ( &training, status ) != status ) {
+        k_work_submit ( &training_work );
+    }
 }
 
 SYS_INIT ( ftms_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY );
@@ -0,0 +1,244 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "hrs.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER ( hrs );
+
+static const struct bt_le_scan_param SCAN_PARAM = {
+    .type = BT_LE_SCAN_TYPE_PASSIVE,
+    .options = BT_LE_SCAN_OPT_FILTER_DUPLICATE,
+    .interval = HRS_SCAN_INTERVAL,
+    .window = HRS_SCAN_WINDOW,
+};
+
+static const struct bt_le_conn_param CONN_PARAM = BT_LE_CONN_PARAM_INIT (
+    HRS_CONN_INT, HRS_CONN_INT, HRS_CONN_LATENCY, HRS_CONN_TIMEOUT );
+
+static void scan_work_handler ( struct k_work *work );
+K_WORK_DELAYABLE_DEFINE ( scan_work, scan_work_handler );
+
+// Only touched from the bluetooth thread and the system work queue
+static struct bt_conn *strap = NULL;
+static struct bt_gatt_discover_params discover_params;
+static struct bt_gatt_subscribe_params subscribe_params;
+
+static atomic_t paused = ATOMIC_INIT ( 0 );
+static atomic_t bpm = ATOMIC_INIT ( 0 );
+static atomic_t bpm_ms = ATOMIC_INIT ( 0 );
+
+static bool ad_has_hrs ( struct bt_data *data, void *user_data )
+{
+    bool *found = user_data;
+    if ( ( data->type != BT_DATA_UUID16_SOME )
+         && ( data->type != BT_DATA_UUID16_ALL ) ) {
+        return true;
+    }
+    for ( size_t i = 0; i + 1 < data->data_len; i += sizeof ( uint16_t ) ) {
+        if ( sys_get_le16 ( &data->data [i] ) == BT_UUID_HRS_VAL ) {
+            *found = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void device_found ( const bt_addr_le_t *addr,
+                           int8_t rssi,
+                           uint8_t type,
+                           struct net_buf_simple *ad )
+{
+    if ( strap || atomic_get ( &paused )
+         || ( ( type != BT_GAP_ADV_TYPE_ADV_IND )
+              && ( type != BT_GAP_ADV_TYPE_ADV_DIRECT_IND ) ) ) {
+        return;
+    }
+    bool found = false;
+    bt_data_parse ( ad, ad_has_hrs, &found );
+    if ( !found ) {
+        return;
+    }
+
+    char str [BT_ADDR_LE_STR_LEN];
+    bt_addr_le_to_str ( addr, str, sizeof ( str ) );
+    LOG_INF ( "Heart rate strap %s (RSSI %d)", str, rssi );
+
+    bt_le_scan_stop();
+    int err = bt_conn_le_create (
+        addr, BT_CONN_LE_CREATE_CONN, &CONN_PARAM, &strap );
+    if ( err ) {
+        LOG_WRN ( "Strap connection failed to start (err %d)", err );
+        k_work_reschedule ( &scan_work, K_MSEC ( HRS_RETRY_MS ) );
+    }
+}
+
+// Stays off the air while an upload has the link, a scan already running
+// is stopped and picked up again once the pause ends
+static void scan_work_handler ( struct k_work *work )
+{
+    if ( strap ) {
+        return;
+    } else if ( atomic_get ( &paused ) ) {
+        int err = bt_le_scan_stop();
+        if ( err && ( err != -EALREADY ) ) {
+            LOG_WRN ( "Scanning failed to stop (err %d)", err );
+        }
+        return;
+    }
+
+    int err = bt_le_scan_start ( &SCAN_PARAM, device_found );
+    if ( err && ( err != -EALREADY ) ) {
+        LOG_WRN ( "Scanning failed to start (err %d)", err );
+        k_work_reschedule ( &scan_work, K_MSEC ( HRS_RETRY_MS ) );
+    }
+}
+
+// 3.113 Heart Rate Measurement, 8 or 16 bit value after the flags
+static uint8_t measurement ( struct bt_conn *conn,
+                             struct bt_gatt_subscribe_params *params,
+                             const void *data,
+                             uint16_t length )
+{
+    const uint8_t *buf = data;
+    if ( !data ) {
+        params->value_handle = 0;
+        return BT_GATT_ITER_STOP;
+    } else if ( length < 2 ) {
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    uint16_t value = buf [1];
+    if ( buf [0] & BIT ( 0 ) ) {
+        if ( length < 3 ) {
+            return BT_GATT_ITER_CONTINUE;
+        }
+        value = sys_get_le16 ( &buf [1] );
+    }
+    atomic_set ( &bpm, MIN ( value, UINT8_MAX ) );
+    atomic_set ( &bpm_ms, k_uptime_get_32() );
+    return BT_GATT_ITER_CONTINUE;
+}
+
+// Measurement value first, then its CCC right behind it
+static uint8_t discovered ( struct bt_conn *conn,
+                            const struct bt_gatt_attr *attr,
+                            struct bt_gatt_discover_params *params )
+{
+    if ( !attr ) {
+        LOG_WRN ( "Heart rate measurement not found" );
+        bt_conn_disconnect ( conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN );
+        return BT_GATT_ITER_STOP;
+    }
+
+    if ( params->type == BT_GATT_DISCOVER_CHARACTERISTIC ) {
+        subscribe_params.value_handle = bt_gatt_attr_value_handle ( attr );
+        params->uuid = BT_UUID_GATT_CCC;
+        params->start_handle = attr->handle + 2;
+        params->type = BT_GATT_DISCOVER_DESCRIPTOR;
+        int err = bt_gatt_discover ( conn, params );
+        if ( err ) {
+            LOG_WRN ( "CCC discovery failed (err %d)", err );
+        }
+        return BT_GATT_ITER_STOP;
+    }
+
+    subscribe_params.notify = measurement;
+    subscribe_params.value = BT_GATT_CCC_NOTIFY;
+    subscribe_params.ccc_handle = attr->handle;
+    int err = bt_gatt_subscribe ( conn, &subscribe_params );
+    if ( err && ( err != -EALREADY ) ) {
+        LOG_WRN ( "Heart rate subscription failed (err %d)", err );
+    } else {
+        LOG_INF ( "Heart rate subscribed" );
+    }
+    return BT_GATT_ITER_STOP;
+}
+
+static void connected ( struct bt_conn *conn, uint8_t err )
+{
+    if ( conn != strap ) {
+        return;
+    } else if ( err ) {
+        LOG_WRN ( "Strap connection failed (err 0x%02x)", err );
+        bt_conn_unref ( strap );
+        strap = NULL;
+        k_work_reschedule ( &scan_work, K_MSEC ( HRS_RETRY_MS ) );
+        return;
+    }
+
+    discover_params.uuid = BT_UUID_HRS_MEASUREMENT;
+    discover_params.func = discovered;
+    discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+    discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+    discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+    int rc = bt_gatt_discover ( conn, &discover_params );
+    if ( rc ) {
+        LOG_WRN ( "Heart rate discovery failed (err %d)", rc );
+        bt_conn_disconnect ( conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN );
+    }
+}
+
+static void disconnected ( struct bt_conn *conn, uint8_t reason )
+{
+    if ( conn != strap ) {
+        return;
+    }
+    LOG_INF ( "Strap disconnected (reason 0x%02x)", reason );
+    bt_conn_unref ( strap );
+    strap = NULL;
+    k_work_reschedule ( &scan_work, K_MSEC ( HRS_RETRY_MS ) );
+}
+
+BT_CONN_CB_DEFINE ( hrs_conn_callbacks )
+    = { .connected = connected, .disconnected = disconnected };
+
+// Call once bluetooth is up, reconnects on its own afterwards
+void hrsStart()
+{
+    k_work_reschedule ( &scan_work, K_NO_WAIT );
+}
+
+// Safe from any context, the scan itself is handled on the work queue
+void hrsPause ( bool pause )
+{
+    atomic_set ( &paused, pause );
+    k_work_reschedule ( &scan_work, K_NO_WAIT );
+}
+
+// Last measurement, its age decides what becomes of it
+uint8_t hrsGetBpm()
+{
+    return atomic_get ( &bpm );
+}
+
+uint32_t hrsGetBpmMs()
+{
+    return atomic_get ( &bpm_ms );
+}
@@ -0,0 +1,166 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "link.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER ( link );
+
+static const struct bt_le_conn_param PARAMS [] = {
+    [LINK_IDLE] = BT_LE_CONN_PARAM_INIT ( LINK_IDLE_INT_MIN,
+                                          LINK_IDLE_INT_MAX,
+                                          LINK_IDLE_LATENCY,
+                                          LINK_IDLE_TIMEOUT ),
+    [LINK_ACTIVE] = BT_LE_CONN_PARAM_INIT ( LINK_ACTIVE_INT_MIN,
+                                            LINK_ACTIVE_INT_MAX,
+                                            LINK_ACTIVE_LATENCY,
+                                            LINK_ACTIVE_TIMEOUT ),
+    [LINK_DFU] = BT_LE_CONN_PARAM_INIT ( LINK_DFU_INT_MIN,
+                                         LINK_DFU_INT_MAX,
+                                         LINK_DFU_LATENCY,
+                                         LINK_DFU_TIMEOUT ),
+};
+
+static const char *const PROFILE_NAMES [] = {
+    [LINK_IDLE] = "idle",
+    [LINK_ACTIVE] = "active",
+    [LINK_DFU] = "dfu",
+};
+
+static volatile linkProfile_t profile = LINK_IDLE;
+static volatile bool dfu = false;
+static uint32_t last_active_ms = 0;
+
+static void apply_profile ( struct bt_conn *conn, void *data )
+{
+    const linkProfile_t p = profile;
+    if ( !linkIsPeripheral ( conn ) ) {
+        return;
+    }
+    int err = bt_conn_le_param_update ( conn, &PARAMS [p] );
+    if ( err && ( err != -EALREADY ) ) {
+        LOG_WRN ( "Connection parameter request failed: %d", err );
+    }
+    if ( p == LINK_IDLE ) {
+        return;
+    }
+
+    // Throughput options only matter while busy, they stay once granted
+    err = bt_conn_le_phy_update ( conn, BT_CONN_LE_PHY_PARAM_2M );
+    if ( err ) {
+        LOG_WRN ( "PHY update request failed: %d", err );
+    }
+    err = bt_conn_le_data_len_update ( conn, BT_LE_DATA_LEN_PARAM_MAX );
+    if ( err ) {
+        LOG_WRN ( "Data length update request failed: %d", err );
+    }
+}
+
+static void set_profile ( linkProfile_t p )
+{
+    if ( p == profile ) {
+        return;
+    }
+    LOG_INF ( "Link profile: %s", PROFILE_NAMES [p] );
+    profile = p;
+    bt_conn_foreach ( BT_CONN_TYPE_LE, apply_profile, NULL );
+}
+
+// Call once per cycle
+void linkUpdate ( const bike_data_t *data, uint32_t now_ms )
+{
+    if ( dfu ) {
+        set_profile ( LINK_DFU );
+    } else if ( data->act_rpm ) {
+        last_active_ms = now_ms;
+        set_profile ( LINK_ACTIVE );
+    } else if ( now_ms - last_active_ms >= LINK_IDLE_MS ) {
+        set_profile ( LINK_IDLE );
+    }
+}
+
+// DFU wants throughput regardless of cadence, afterwards the link counts
+// as just active and relaxes as usual
+void linkSetDfu ( bool active )
+{
+    dfu = active;
+    last_active_ms = k_uptime_get_32();
+    set_profile ( active ? LINK_DFU : LINK_ACTIVE );
+}
+
+// Apps steer the peripheral links, our own central links keep their own
+// schedule
+bool linkIsPeripheral ( struct bt_conn *conn )
+{
+    struct bt_conn_info info;
+    return !bt_conn_get_info ( conn, &info )
+           && ( info.role == BT_CONN_ROLE_PERIPHERAL );
+}
+
+static void connected ( struct bt_conn *conn, uint8_t err )
+{
+    if ( !err ) {
+        apply_profile ( conn, NULL );
+    }
+}
+
+static void le_param_updated ( struct bt_conn *conn,
+                               uint16_t interval,
+                               uint16_t latency,
+                               uint16_t timeout )
+{
+    LOG_INF ( "Connection %u: interval %u.%02u ms, latency %u, timeout %u ms",
+              bt_conn_index ( conn ),
+              ( interval * 125 ) / 100,
+              ( interval * 125 ) % 100,
+              latency,
+              timeout * 10 );
+}
+
+static void le_phy_updated ( struct bt_conn *conn,
+                             struct bt_conn_le_phy_info *param )
+{
+    LOG_INF ( "Connection %u: PHY tx %u, rx %u",
+              bt_conn_index ( conn ),
+              param->tx_phy,
+              param->rx_phy );
+}
+
+static void le_data_len_updated ( struct bt_conn *conn,
+                                  struct bt_conn_le_data_len_info *info )
+{
+    LOG_INF ( "Connection %u: data length tx %u B / %u us, rx %u B / %u us",
+              bt_conn_index ( conn ),
+              info->tx_max_len,
+              info->tx_max_time,
+              info->rx_max_len,
+              info->rx_max_time );
+}
+
+BT_CONN_CB_DEFINE ( link_conn_callbacks ) = {
+    .connected = connected,
+    .le_param_updated = le_param_updated,
+    .le_phy_updated = le_phy_updated,
+    .le_data_len_updated = le_data_len_updated,
+};
@@ -28,27 +28,45 @@
 #include <zephyr/drivers/uart.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#if defined( CONFIG_MCUMGR_SMP_BT )
 #include <zephyr/mgmt/mcumgr/transport/smp_bt.h>
+#endif
 #include <zephyr/random/rand32.h>
+#include <zephyr/settings/settings.h>
 #include <zephyr/types.h>
 
+#include "advertising.h"
 #include "asciiModbus.h"
 #include "bikeControl.h"
+#include "broadcast.h"
 #include "cps.h"
+#include "crank.h"
 #include "cscs.h"
 #include "display.h"
-// #include "fec.h"
+#include "dsp.h"
+#include "fec.h"
 #include "ftms.h"
+#include "hrs.h"
+#include "link.h"
+#include "metrics.h"
+#include "sample.h"
+#include "speed.h"
+#include "telemetry.h"
 #include "version.h"
+#include "workout.h"
 
 LOG_MODULE_REGISTER ( app );
 
-#define DEVICE_NAME CONFIG_BT_DEVICE_NAME
-#define DEVICE_NAME_LEN ( sizeof ( DEVICE_NAME ) - 1 )
-#define BT_DEVICE_CYCLING_APPEARANCE 0x012
-
 #define TGT_CYCLE_MS 500
 
+// The simulated board has no bike bus, buttons, counter or display, it
+// runs on generated rider input like the development kits
+#if defined( CONFIG_BOARD_NRF52_BSIM )
+#define BIKE_IO 0
+#else
+#define BIKE_IO 1
+#endif
+
 #define LED0_NODE DT_ALIAS ( led0 )
 #define RS485DE_NODE DT_ALIAS ( rs485de )
 #define CPT_RST_NODE DT_ALIAS ( cptrst )
@@ -67,55 +85,6 @@ LOG_MODULE_REGISTER ( app );
 #define TX_TIMEOUT_US 2000
 #define SEM_TIMEOUT K_MSEC ( 50 )
 
-static const struct bt_data ad []
-    = { BT_DATA_BYTES ( BT_DATA_GAP_APPEARANCE,
-                        ( BT_DEVICE_CYCLING_APPEARANCE >> 0 ) & 0xff,
-                        ( BT_DEVICE_CYCLING_APPEARANCE >> 8 ) & 0xff ),
-        BT_DATA_BYTES ( BT_DATA_FLAGS,
-                        ( BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR ) ),
-        BT_DATA_BYTES ( BT_DATA_UUID16_ALL,
-                        BT_UUID_16_ENCODE ( BT_UUID_CPS_VAL ),
-                        BT_UUID_16_ENCODE ( BT_UUID_CSC_VAL ),
-                        BT_UUID_16_ENCODE ( BT_UUID_FTMS_VAL ) ),
-        BT_DATA ( BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN ) };
-
-static const struct bt_data sd [] = {
-    BT_DATA_BYTES ( BT_DATA_UUID128_ALL,
-                    0x84,
-                    0xaa,
-                    0x60,
-                    0x74,
-                    0x52,
-                    0x8a,
-                    0x8b,
-                    0x86,
-                    0xd3,
-                    0x4c,
-                    0xb7,
-                    0x1d,
-                    0x1d,
-                    0xdc,
-                    0x53,
-                    0x8d ),
-};
-
-static void adv_start ( void )
-{
-    int err;
-
-    err = bt_le_adv_start ( BT_LE_ADV_CONN,
-                            ad,
-                            ARRAY_SIZE ( ad ),
-                            sd,
-                            ARRAY_SIZE ( sd ) );
-    if ( err ) {
-        LOG_ERR ( "Advertising failed to start (err %d)", err );
-        return;
-    }
-
-    LOG_INF ( "Advertising successfully started" );
-}
-
 static void connected ( struct bt_conn *conn, uint8_t err )
 {
     if ( err ) {
@@ -133,6 +102,7 @@ static void disconnected ( struct bt_conn *conn, uint8_t reason )
 BT_CONN_CB_DEFINE ( conn_callbacks )
     = { .connected = connected, .disconnected = disconnected };
 
+#if BIKE_IO
 K_SEM_DEFINE ( rs485_sem, 0, 1 );
 K_CONDVAR_DEFINE ( txDoneVar );
 K_CONDVAR_DEFINE ( rxDoneVar );
@@ -370,16 +340,9 @@ static void uart_cb ( const struct device *dev,
     }
 }
 
-void main ( void )
+// Buttons, bike bus and the debounce counter
+static int init_bike_io()
 {
-    LOG_INF ( "Starting application, board: %s", CONFIG_BOARD );
-    LOG_INF ( "Software: %s:%s", GIT_BRANCH, GIT_COMMIT_HASH );
-
-    LOG_INF ( "Registering callbacks..." );
-    setSendMsgCb ( send_cmd );
-    ftmsSetTargetsCb ( updateBikeTgts );
-    // fecSetTargetsCb ( updateBikeTgts );
-
     LOG_INF ( "Configuring GPIO..." );
     int ret = 0;
     if ( !device_is_ready ( led.port ) ) {
@@ -405,7 +368,7 @@ void main ( void )
     }
     if ( ret ) {
         LOG_ERR ( "A port was not ready!" );
-        return;
+        return -EIO;
     }
     if ( gpio_pin_configure_dt ( &led, GPIO_OUTPUT_ACTIVE ) < 0 ) {
         ret++;
@@ -430,7 +393,7 @@ void main ( void )
     }
     if ( ret ) {
         LOG_ERR ( "Configuration failed of %d devices!", ret );
-        return;
+        return -EIO;
     }
     if ( gpio_pin_interrupt_configure_dt ( &addInc, GPIO_INT_EDGE_TO_ACTIVE )
          != 0 ) {
@@ -450,7 +413,7 @@ void main ( void )
     }
     if ( ret ) {
         LOG_ERR ( "Setting of pin interrupt failed on %d devices!", ret );
-        return;
+        return -EIO;
     }
     gpio_init_callback ( &addIncCbData, incPressed, BIT ( addInc.pin ) );
     gpio_init_callback ( &subIncCbData, incPressed, BIT ( subInc.pin ) );
@@ -470,14 +433,14 @@ void main ( void )
     }
     if ( ret ) {
         LOG_ERR ( "Setting of input callbacks failed on %d devices!", ret );
-        return;
+        return -EIO;
     }
 
     LOG_INF ( "Starting Uart1..." );
     uart = DEVICE_DT_GET ( DT_NODELABEL ( uart1 ) );
     if ( !device_is_ready ( uart ) ) {
         LOG_ERR ( "Uart1 not ready!" );
-        return;
+        return -EIO;
     }
     LOG_INF ( "Checking Uart1 ready..." );
     uint32_t start_ms = k_uptime_get_32();
@@ -487,7 +450,7 @@ void main ( void )
             uint32_t end_ms = k_uptime_get_32();
             if ( end_ms - start_ms > 2000 ) {
                 LOG_ERR ( "UART1 check failed: %d", ret );
-                return;
+                return -EIO;
             }
             k_msleep ( 10 );
         }
@@ -502,42 +465,91 @@ void main ( void )
     ret = uart_configure ( uart, &uart_cfg );
     if ( ret ) {
         LOG_ERR ( "Uart1 configure failure: %d", ret );
-        return;
+        return -EIO;
     }
     ret = uart_callback_set ( uart, uart_cb, NULL );
     if ( ret ) {
         LOG_ERR ( "Uart1 callback set failure: %d", ret );
-        return;
+        return -EIO;
     }
     ret = enable_rx();
     if ( ret ) {
         LOG_ERR ( "Uart1 rx buffer enable failure: %d", ret );
-        return;
-    }
-
-    LOG_INF ( "Initializing bluetooth..." );
-    smp_bt_register();
-    ret = bt_enable ( NULL );
-    if ( ret ) {
-        LOG_ERR ( "Bluetooth init failed (err %d)", ret );
-        return;
+        return -EIO;
     }
-    LOG_INF ( "Starting advertising..." );
-    adv_start();
 
     LOG_INF ( "Starting counter..." );
     if ( !device_is_ready ( rtc2_dev ) ) {
         LOG_ERR ( "Counter is not ready!" );
-        return;
+        return -EIO;
     }
     if ( counter_start ( rtc2_dev ) ) {
         LOG_ERR ( "Counter failed to start!" );
-        return;
+        return -EIO;
     }
     alarmCfg.flags = 0;
     alarmCfg.callback = counter_interrupt_cb;
     alarmCfg.user_data = &alarmCfg;
 
+    return 0;
+}
+
+static void toggle_led()
+{
+    gpio_pin_toggle_dt ( &led );
+}
+#else
+int send_cmd ( cmd_msg_data_t cmd )
+{
+    return 0;
+}
+
+static int init_bike_io()
+{
+    return 0;
+}
+
+static void toggle_led()
+{
+}
+#endif  // BIKE_IO
+
+void main ( void )
+{
+    LOG_INF ( "Starting application, board: %s", CONFIG_BOARD );
+    LOG_INF ( "Software: %s:%s", GIT_BRANCH, GIT_COMMIT_HASH );
+
+    LOG_INF ( "Registering callbacks..." );
+    setSendMsgCb ( send_cmd );
+    ftmsSetTargetsCb ( updateBikeTgts );
+    fecSetTargetsCb ( updateBikeTgts );
+
+    int ret = init_bike_io();
+    if ( ret ) {
+        LOG_ERR ( "Bike I/O initialization failed (err %d)", ret );
+        return;
+    }
+
+    LOG_INF ( "Initializing bluetooth..." );
+#if defined( CONFIG_MCUMGR_SMP_BT )
+    smp_bt_register();
+#endif
+    ret = bt_enable ( NULL );
+    if ( ret ) {
+        LOG_ERR ( "Bluetooth init failed (err %d)", ret );
+        return;
+    }
+    if ( IS_ENABLED ( CONFIG_BT_SETTINGS ) ) {
+        ret = settings_load();
+        if ( ret ) {
+            LOG_ERR ( "Settings load failed (err %d)", ret );
+        }
+    }
+    LOG_INF ( "Starting advertising..." );
+    advStart();
+    bcastStart();
+    hrsStart();
+
     // Configure nodes
     LOG_INF ( "Configuring bike nodes..." );
     initBike();
@@ -554,24 +566,45 @@ void main ( void )
     bike_data_t bikeData;
     while ( 1 ) {
         // Set start time
-        start_ms = k_uptime_get_32();
+        const uint32_t start_ms = k_uptime_get_32();
 
         // Update bike
-        gpio_pin_toggle_dt ( &led );
+        toggle_led();
+        workoutUpdate ( start_ms );
         updateBike();
         bikeData = getBikeData();
-#if defined( CONFIG_BOARD_NRF52840DK_NRF52840 ) \
-    || defined( CONFIG_BOARD_NRF52840DONGLE_NRF52840 )
+#if defined( CONFIG_BOARD_NRF52840DK_NRF52840 )     \
+    || defined( CONFIG_BOARD_NRF52840DONGLE_NRF52840 ) \
+    || defined( CONFIG_BOARD_NRF52_BSIM )
         bikeData.act_rpm = ( sys_rand32_get() % 21 ) + 80;
         bikeData.watts = ( sys_rand32_get() % 101 ) + 200;
+        bikeData.rpm_ms = start_ms;
+#if defined( BSIM_RPM_GAP_MS )
+        // Bus outage for tests, no replies for the end of every 10 s
+        const uint32_t phase_ms = start_ms % 10000;
+        if ( phase_ms > 10000 - BSIM_RPM_GAP_MS ) {
+            bikeData.rpm_ms -= phase_ms - ( 10000 - BSIM_RPM_GAP_MS );
+        }
+#endif
 #endif
 
+        // Age out readings before anything is derived from them
+        bikeData.heart_bpm = hrsGetBpm();
+        bikeData.hr_ms = hrsGetBpmMs();
+        sampleApply ( &bikeData );
+
+        // Smooth telemetry and accumulate ride metrics
+        ret = dspUpdate ( bikeData.watts, bikeData.act_rpm, start_ms );
+        bikeData.watts_3s = dspGetPower3s();
+        bikeData.rpm_filt = dspGetCadence();
+        speedUpdate ( &bikeData, start_ms );
+        crankUpdate ( &bikeData, start_ms );
+        metricsUpdate ( &bikeData, start_ms, ret );
+        bikeData.ride = metricsGet();
+
         // Update bluetooth services
-        bt_cscs_bike_notify ( bikeData );
-        bt_cps_notify ( bikeData );
-        bt_ftms_bike_notify ( bikeData );
-        // bt_fec_update ( bikeData );
-        bt_ftms_status_notify();
+        telemetryPublish ( &bikeData );
+        linkUpdate ( &bikeData, start_ms );
 
         // Update display
         updateDisplay ( bikeData );
@@ -579,7 +612,7 @@ void main ( void )
         // Sleep to hit cycle target
         exec_ms = k_uptime_get_32() - start_ms;
         if ( exec_ms < TGT_CYCLE_MS ) {
-            k_msleep ( TGT_CYCLE_MS - exec_ms );
+            waitBikeInput ( TGT_CYCLE_MS - exec_ms );
         }
     }
 }
@@ -0,0 +1,113 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metrics.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "dsp.h"
+
+LOG_MODULE_REGISTER ( metrics );
+
+// Running sums, everything is O(1) per sample
+static uint64_t watt_ms = 0;  // Energy in mJ
+static uint64_t rpm_ms = 0;   // Revolutions * 60000
+static uint64_t dist_um = 0;  // mm/s * ms
+static uint64_t np_sum = 0;   // Sum of 30s rolling power ^ 4
+static uint32_t np_cnt = 0;
+static uint32_t last_ms = 0;
+static bool started = false;
+static atomic_t reset_req = ATOMIC_INIT ( 0 );
+static ride_metrics_t metrics = {};
+
+static void reset_sums()
+{
+    watt_ms = 0;
+    rpm_ms = 0;
+    dist_um = 0;
+    np_sum = 0;
+    np_cnt = 0;
+    memset ( &metrics, 0, sizeof ( metrics ) );
+}
+
+// Safe from any context, applied on the next update
+void metricsReset()
+{
+    LOG_INF ( "Resetting ride metrics..." );
+    atomic_set ( &reset_req, 1 );
+}
+
+void metricsUpdate ( const bike_data_t *data, uint32_t now_ms, int dspTicks )
+{
+    if ( atomic_cas ( &reset_req, 1, 0 ) ) {
+        reset_sums();
+    }
+
+    uint32_t dt_ms = started ? now_ms - last_ms : 0;
+    last_ms = now_ms;
+    started = true;
+    if ( dt_ms > METRICS_MAX_DT_MS ) {
+        dt_ms = METRICS_MAX_DT_MS;
+    }
+
+    // Only moving time counts
+    if ( data->act_rpm ) {
+        metrics.elapsed_ms += dt_ms;
+        watt_ms += ( uint64_t )data->watts * dt_ms;
+        rpm_ms += ( uint64_t )data->act_rpm * dt_ms;
+        if ( data->watts > metrics.max_watts ) {
+            metrics.max_watts = data->watts;
+        }
+        if ( data->act_rpm > metrics.max_rpm ) {
+            metrics.max_rpm = data->act_rpm;
+        }
+    }
+
+    // Speed decays after pedaling stops, so distance keeps integrating
+    dist_um += ( uint64_t )data->speed_mmps * dt_ms;
+
+    // Normalized power uses every filter tick once the ride has started
+    if ( metrics.elapsed_ms ) {
+        const uint64_t p30 = dspGetPower30s();
+        for ( int i = 0; i < dspTicks; i++ ) {
+            np_sum += p30 * p30 * p30 * p30;
+            np_cnt++;
+        }
+    }
+
+    if ( metrics.elapsed_ms ) {
+        metrics.avg_watts = watt_ms / metrics.elapsed_ms;
+        metrics.avg_rpm = rpm_ms / metrics.elapsed_ms;
+    }
+    if ( np_cnt ) {
+        metrics.np_watts = sqrtf ( sqrtf ( ( float )( np_sum / np_cnt ) ) );
+    }
+    metrics.energy_j = watt_ms / 1000;
+    metrics.total_revs = rpm_ms / 60000;
+    metrics.distance_m = dist_um / 1000000;
+}
+
+ride_metrics_t metricsGet()
+{
+    return metrics;
+}
@@ -0,0 +1,187 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "powerModel.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#define LVL_CNT ( RES_MAX_LVL - RES_MIN_LVL + 1 )
+
+LOG_MODULE_REGISTER ( power_model );
+
+// Watts by [rpm bin][level - 1], filled once at boot
+static uint16_t pm_table [PM_RPM_BINS][LVL_CNT];
+
+//
+// The following "Phyics-Based" model is based on analysis of coast-down data
+// collected from an s22i bike. It estimates the power required to maintain a
+// given flywheel speed (in RPM) at a given eddy-current brake level (1..22).
+// The model accounts for both eddy-current drag and Coulomb friction losses,   
+// and can be adapted to either crank or flywheel speed sensors.
+//
+
+/*** BIKE CONSTANTS ***/
+#define SENSOR_IS_CRANK            1          // 1 = rpm is crank cadence; 0 = flywheel
+#define R_FLYWHEEL_PER_CRANK       5.317f
+#define DRIVETRAIN_ETA             0.95f
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static inline double rpm_to_rads(double rpm){ return rpm * (2.0 * M_PI / 60.0); }
+
+/*** Eddy-current k(L): log-linear interpolation over anchors ***/
+static const int    K_LVLS[] = {  1,   4,   10,   13,   16,    18,    20,    22 };
+static const double K_VALS[] = { 0.0308857954, 0.0308857954, 0.0458868358, 0.0619309863,
+                                 0.0753609278, 0.1123894586, 0.1123894586, 0.1635043007 };
+static const int K_COUNT = sizeof(K_LVLS)/sizeof(K_LVLS[0]);
+
+static double k_for_level(int L){
+    if (L <= K_LVLS[0]) return K_VALS[0];
+    if (L >= K_LVLS[K_COUNT-1]) return K_VALS[K_COUNT-1];
+    for (int i=0;i<K_COUNT-1;i++){
+        int L0 = K_LVLS[i], L1 = K_LVLS[i+1];
+        if (L >= L0 && L <= L1){
+            double y0 = log(K_VALS[i]), y1 = log(K_VALS[i+1]);
+            double t  = (double)(L - L0) / (double)(L1 - L0);
+            return exp(y0 + t*(y1 - y0));
+        }
+    }
+    return K_VALS[K_COUNT-1];
+}
+
+/*** Coulomb friction torque vs level (N·m) ***/
+static inline double Tc_for_level(int L){
+    const double a = 0.0166779771;   // N·m per level
+    const double b = 0.4338270944;   // N·m base
+    double Tc = b + a * (double)L;
+    return (Tc > 0.0) ? Tc : 0.0;
+}
+
+/*** CORE API: pass crank rpm and resistance level ***/
+uint16_t calc_watts_physics_params(double rpm_crank, int level)
+{
+    if (rpm_crank <= 0.0) return 0;
+    if (level < 1) level = 1; else if (level > 22) level = 22;
+
+    // flywheel angular speed
+    double rpm_fly = SENSOR_IS_CRANK ? rpm_crank * (double)R_FLYWHEEL_PER_CRANK : rpm_crank;
+    double omega   = rpm_to_rads(rpm_fly); // rad/s
+
+    // model
+    double k  = k_for_level(level);   // W / (rad/s)^2
+    double Tc = Tc_for_level(level);  // N·m
+    double Pf = k*(omega*omega) + Tc*omega;      // flywheel watts
+    if (!(Pf > 0.0)) Pf = 0.0;
+
+    double W  = Pf / (double)DRIVETRAIN_ETA;     // pedal watts
+    if (W < 1.0) W = 1.0;
+    if (W > 65535.0) W = 65535.0;
+    return (uint16_t)(W + 0.5);
+}
+
+// Integer interpolation along rpm for a single level index
+static uint16_t watts_at_rpm ( uint16_t rpm, int lvl_idx )
+{
+    int bin = rpm / PM_RPM_STEP;
+    if ( bin >= PM_RPM_BINS - 1 ) {
+        return pm_table [PM_RPM_BINS - 1][lvl_idx];
+    }
+    uint32_t frac = rpm % PM_RPM_STEP;
+    return ( pm_table [bin][lvl_idx] * ( PM_RPM_STEP - frac )
+             + pm_table [bin + 1][lvl_idx] * frac )
+           / PM_RPM_STEP;
+}
+
+// Forward model, bilinear over the table
+uint16_t pmWatts ( uint16_t rpm, uint16_t res_mag )
+{
+    if ( !rpm ) {
+        return 0;
+    }
+    if ( res_mag < RES_MIN_MAG ) {
+        res_mag = RES_MIN_MAG;
+    }
+    uint32_t steps = res_mag - RES_MIN_MAG;
+    int idx = steps / RES_MAG_PER_LVL;
+    if ( idx >= LVL_CNT - 1 ) {
+        return watts_at_rpm ( rpm, LVL_CNT - 1 );
+    }
+    uint32_t frac = steps % RES_MAG_PER_LVL;
+    return ( watts_at_rpm ( rpm, idx ) * ( RES_MAG_PER_LVL - frac )
+             + watts_at_rpm ( rpm, idx + 1 ) * frac )
+           / RES_MAG_PER_LVL;
+}
+
+// Inverse model, smallest magnitude that absorbs the requested watts
+uint16_t pmResForWatts ( uint16_t rpm, uint16_t watts )
+{
+    if ( !rpm ) {
+        return RES_MIN_MAG;
+    }
+
+    // Watts are monotonic in level, binary search the level column
+    int lo = 0;
+    int hi = LVL_CNT - 1;
+    if ( watts <= watts_at_rpm ( rpm, lo ) ) {
+        return RES_MIN_MAG;
+    }
+    if ( watts >= watts_at_rpm ( rpm, hi ) ) {
+        return RES_MIN_MAG + RES_MAG_PER_LVL * hi;
+    }
+    while ( hi - lo > 1 ) {
+        int mid = ( lo + hi ) / 2;
+        if ( watts_at_rpm ( rpm, mid ) < watts ) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Interpolate within the bracketing levels
+    uint32_t w_lo = watts_at_rpm ( rpm, lo );
+    uint32_t w_hi = watts_at_rpm ( rpm, hi );
+    uint32_t frac = 0;
+    if ( w_hi > w_lo ) {
+        frac = ( ( watts - w_lo ) * RES_MAG_PER_LVL + ( w_hi - w_lo ) / 2 )
+               / ( w_hi - w_lo );
+    }
+    return RES_MIN_MAG + RES_MAG_PER_LVL * lo + frac;
+}
+
+static int power_model_init ( const struct device *dev )
+{
+    ARG_UNUSED ( dev );
+
+    for ( int bin = 0; bin < PM_RPM_BINS; bin++ ) {
+        for ( int lvl = 0; lvl < LVL_CNT; lvl++ ) {
+            pm_table [bin][lvl] = calc_watts_physics_params (
+                ( double )( bin * PM_RPM_STEP ), lvl + RES_MIN_LVL );
+        }
+    }
+
+    LOG_INF ( "Power model initialized" );
+
+    return 0;
+}
+
+SYS_INIT ( power_model_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY );
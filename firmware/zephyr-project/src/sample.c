@@ -0,0 +1,83 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "sample.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+LOG_MODULE_REGISTER ( sample );
+
+typedef struct
+{
+    uint8_t sample;
+    uint32_t max_age_ms;
+    samplePolicy_t policy;
+} sample_limit_t;
+
+static const sample_limit_t LIMITS [] = {
+    { BIKE_SAMPLE_RPM, SAMPLE_RPM_MAX_AGE_MS, SAMPLE_RPM_POLICY },
+    { BIKE_SAMPLE_HR, SAMPLE_HR_MAX_AGE_MS, SAMPLE_HR_POLICY },
+};
+
+// Only touched from the main loop
+static uint8_t last_stale = 0;
+
+static uint32_t captured_ms ( const bike_data_t *data, uint8_t sample )
+{
+    return ( sample == BIKE_SAMPLE_RPM ) ? data->rpm_ms : data->hr_ms;
+}
+
+static void decay ( bike_data_t *data, uint8_t sample )
+{
+    if ( sample == BIKE_SAMPLE_RPM ) {
+        data->act_rpm = 0;
+        data->watts = 0;
+    } else {
+        data->heart_bpm = 0;
+    }
+}
+
+// Call on fresh readings, before anything is derived from them. A sample
+// never captured (no strap) has nothing to go stale and is left alone
+void sampleApply ( bike_data_t *data )
+{
+    const uint32_t now_ms = k_uptime_get_32();
+    data->stale = 0;
+    data->invalid = 0;
+    for ( size_t i = 0; i < ARRAY_SIZE ( LIMITS ); i++ ) {
+        const sample_limit_t *limit = &LIMITS [i];
+        const uint32_t at_ms = captured_ms ( data, limit->sample );
+        if ( !at_ms || ( now_ms - at_ms <= limit->max_age_ms ) ) {
+            continue;
+        }
+        data->stale |= limit->sample;
+        if ( limit->policy == SAMPLE_DECAY ) {
+            decay ( data, limit->sample );
+        } else if ( limit->policy == SAMPLE_INVALID ) {
+            data->invalid |= limit->sample;
+        }
+    }
+
+    if ( data->stale != last_stale ) {
+        LOG_INF ( "Stale samples: 0x%02x", data->stale );
+        last_stale = data->stale;
+    }
+}
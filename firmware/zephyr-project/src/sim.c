@@ -0,0 +1,189 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sim.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include "powerModel.h"
+
+// Wheel speed per crank rpm for each gear, Q8 mm/s
+#define GEAR_MMPS_Q8( front, rear ) \
+    ( ( ( front ) * SIM_WHEEL_MM * 256UL + ( rear ) * 30UL ) / ( ( rear ) * 60UL ) ),
+
+LOG_MODULE_REGISTER ( sim );
+
+static const uint16_t GEARS [] = { SIM_GEAR_TABLE ( GEAR_MMPS_Q8 ) };
+BUILD_ASSERT ( SIM_DEFAULT_GEAR < ARRAY_SIZE ( GEARS ) );
+
+// Raw parameters, written from the FTMS work queue
+static struct k_spinlock lock;
+static sim_params_t params
+    = { 0, 0, SIM_DEFAULT_CRR, SIM_DEFAULT_CW };
+static bool dirty = true;
+
+// Derived forces, only touched by the control loop
+static sim_forces_t forces = {};
+static uint16_t pwr_table [SIM_SPEED_BINS];
+static bool table_stale = true;
+
+// Current gear, shifted from the button interrupt
+static volatile uint8_t gear = SIM_DEFAULT_GEAR;
+
+void simSetParams ( int16_t wind_mmps, uint8_t crr, uint8_t cw )
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( wind_mmps != 0x7FFF ) {
+        params.wind_mmps = wind_mmps;
+    }
+    if ( crr != 0xFF ) {
+        params.crr = crr;
+    }
+    if ( cw != 0xFF ) {
+        params.cw = cw;
+    }
+    dirty = true;
+    k_spin_unlock ( &lock, key );
+}
+
+void simSetGrade ( int16_t grade )
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    params.grade = grade;
+    dirty = true;
+    k_spin_unlock ( &lock, key );
+}
+
+sim_params_t simGetParams()
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    const sim_params_t p = params;
+    k_spin_unlock ( &lock, key );
+    return p;
+}
+
+// Trig only runs when parameters change, never per sample. The snapshot
+// and the flag are taken together, a write landing later sets it again.
+static void update_forces()
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( !dirty ) {
+        k_spin_unlock ( &lock, key );
+        return;
+    }
+    const sim_params_t p = params;
+    dirty = false;
+    k_spin_unlock ( &lock, key );
+
+    const float theta = atanf ( p.grade / 10000.0f );
+    const float crr = p.crr / 10000.0f;
+    forces.f_const = SIM_MASS_KG * SIM_GRAVITY
+                     * ( sinf ( theta ) + crr * cosf ( theta ) );
+    forces.cw = p.cw / 100.0f;
+    forces.wind = p.wind_mmps / 1000.0f;
+    table_stale = true;
+    LOG_INF ( "Sim grade: %d, wind: %d, Crr: %u, Cw: %u",
+              p.grade,
+              p.wind_mmps,
+              p.crr,
+              p.cw );
+}
+
+void simShift ( int8_t dir )
+{
+    if ( ( dir > 0 ) && ( gear < ARRAY_SIZE ( GEARS ) - 1 ) ) {
+        gear++;
+    } else if ( ( dir < 0 ) && ( gear > 0 ) ) {
+        gear--;
+    } else {
+        return;
+    }
+    LOG_INF ( "Shifted to gear: %u", gear + 1 );
+}
+
+uint8_t simGetGear()
+{
+    return gear;
+}
+
+// Wheel speed in mm/s for the current gear
+uint16_t simWheelSpeed ( uint16_t rpm )
+{
+    uint32_t mmps = ( ( uint32_t )rpm * GEARS [gear] ) >> 8;
+    return mmps > 0xFFFF ? 0xFFFF : mmps;
+}
+
+sim_forces_t simGetForces()
+{
+    update_forces();
+    return forces;
+}
+
+static float required_watts ( const sim_forces_t *f, float speed_mps )
+{
+    const float rel = speed_mps + f->wind;
+    const float f_air = f->cw * rel * fabsf ( rel );
+    const float watts = ( f->f_const + f_air ) * speed_mps / SIM_DRIVETRAIN_ETA;
+    return watts > 0.0f ? watts : 0.0f;
+}
+
+float simRequiredWatts ( float speed_mps )
+{
+    const sim_forces_t f = simGetForces();
+    return required_watts ( &f, speed_mps );
+}
+
+// Reads forces directly so the whole table comes from one parameter set
+static void build_pwr_table()
+{
+    for ( int i = 0; i < SIM_SPEED_BINS; i++ ) {
+        float watts = required_watts (
+            &forces, i * ( SIM_SPEED_STEP_MMPS / 1000.0f ) );
+        pwr_table [i] = watts > 0xFFFF ? 0xFFFF : ( uint16_t )( watts + 0.5f );
+    }
+    table_stale = false;
+}
+
+static uint16_t lookup_watts ( uint16_t mmps )
+{
+    uint16_t i = mmps / SIM_SPEED_STEP_MMPS;
+    if ( i >= SIM_SPEED_BINS - 1 ) {
+        return pwr_table [SIM_SPEED_BINS - 1];
+    }
+    int32_t frac = mmps % SIM_SPEED_STEP_MMPS;
+    int32_t delta = ( int32_t )pwr_table [i + 1] - pwr_table [i];
+    return pwr_table [i] + delta * frac / SIM_SPEED_STEP_MMPS;
+}
+
+// Call once per cadence sample, returns the magnitude to apply
+uint16_t simUpdate ( uint16_t rpm )
+{
+    update_forces();
+    if ( table_stale ) {
+        build_pwr_table();
+    }
+    if ( !rpm ) {
+        return RES_MIN_MAG;
+    }
+    return pmResForWatts ( rpm, lookup_watts ( simWheelSpeed ( rpm ) ) );
+}
@@ -0,0 +1,101 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "speed.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/logging/log.h>
+
+#include "sim.h"
+
+#define WHEEL_UM ( SIM_WHEEL_MM * 1000ULL )
+
+LOG_MODULE_REGISTER ( speed );
+
+static float v_mps = 0.0f;
+static uint64_t travel_um = 0;  // Since the last whole wheel revolution
+static uint32_t wheel_revs = 0;
+static uint32_t wheel_evt_ms = 0;
+static uint32_t last_ms = 0;
+static bool started = false;
+
+// Solve the road load equation for speed, P = ( F + Cw * v_air^2 ) * v
+static float solve_speed ( float watts )
+{
+    const sim_forces_t f = simGetForces();
+    const float p = watts * SIM_DRIVETRAIN_ETA;
+    float v = v_mps > 1.0f ? v_mps : 5.0f;
+
+    for ( int i = 0; i < SPEED_MAX_ITERS; i++ ) {
+        const float rel = v + f.wind;
+        const float drag = f.cw * rel * fabsf ( rel );
+        const float g = ( f.f_const + drag ) * v - p;
+        const float dg = f.f_const + drag + 2.0f * f.cw * fabsf ( rel ) * v;
+        if ( dg <= 0.0f ) {
+            // Downhill below the minimum, step right onto the convex side
+            v = 2.0f * v + 1.0f;
+        } else {
+            const float step = g / dg;
+            v -= step;
+            if ( fabsf ( step ) < SPEED_TOL_MPS ) {
+                break;
+            }
+        }
+        if ( v < 0.0f ) {
+            v = 0.0f;
+        } else if ( v > SPEED_MAX_MPS ) {
+            v = SPEED_MAX_MPS;
+        }
+    }
+    return v;
+}
+
+static void update_wheel ( uint16_t mmps, uint32_t now_ms, uint32_t dt_ms )
+{
+    travel_um += ( uint64_t )mmps * dt_ms;
+    if ( travel_um < WHEEL_UM ) {
+        return;
+    }
+
+    // Back date the event to when the last revolution completed
+    const uint32_t revs = travel_um / WHEEL_UM;
+    wheel_revs += revs;
+    travel_um -= revs * WHEEL_UM;
+    wheel_evt_ms = now_ms - ( uint32_t )( travel_um / mmps );
+}
+
+// Call once per sample, fills in speed and wheel data
+void speedUpdate ( bike_data_t *data, uint32_t now_ms )
+{
+    uint32_t dt_ms = started ? now_ms - last_ms : 0;
+    last_ms = now_ms;
+    started = true;
+    if ( dt_ms > SPEED_MAX_DT_MS ) {
+        dt_ms = SPEED_MAX_DT_MS;
+    }
+
+    // The 3s average stands in for flywheel inertia
+    v_mps = data->watts_3s ? solve_speed ( data->watts_3s ) : 0.0f;
+    data->speed_mmps = ( uint16_t )( v_mps * 1000.0f + 0.5f );
+
+    update_wheel ( data->speed_mmps, now_ms, dt_ms );
+    data->wheel_revs = wheel_revs;
+    data->wheel_evt_ms = wheel_evt_ms;
+}
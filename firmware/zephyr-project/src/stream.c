@@ -0,0 +1,202 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/l2cap.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER ( stream );
+
+// Batches being filled, queued and in the controller all come from here,
+// so a stalled peer runs the pool dry instead of blocking the bus loop
+NET_BUF_POOL_FIXED_DEFINE ( stream_pool,
+                            STREAM_BATCHES,
+                            BT_L2CAP_SDU_BUF_SIZE ( STREAM_MTU ),
+                            CONFIG_BT_CONN_TX_USER_DATA_SIZE,
+                            NULL );
+
+static void send_work_handler ( struct k_work *work );
+K_WORK_DEFINE ( send_work, send_work_handler );
+static void flush_work_handler ( struct k_work *work );
+K_WORK_DELAYABLE_DEFINE ( flush_work, flush_work_handler );
+K_FIFO_DEFINE ( ready );
+
+static struct bt_l2cap_le_chan le_chan;
+static atomic_t chan_up = ATOMIC_INIT ( 0 );
+static struct k_spinlock lock;
+static struct net_buf *cur = NULL;
+static uint32_t cur_ms = 0;
+static uint16_t batch_max = 0;
+static uint16_t seq = 0;
+static uint32_t sent = 0;
+static uint32_t dropped = 0;
+
+// Batch that found no buffer, filled on paper so a dry pool costs one
+// seq number per batch it would have sent rather than per record
+static bool lost = false;
+static uint16_t lost_len = 0;
+
+static void chan_connected ( struct bt_l2cap_chan *chan )
+{
+    batch_max = MIN ( le_chan.tx.mtu, STREAM_MTU );
+    atomic_set ( &chan_up, 1 );
+    LOG_INF ( "Stream connected, %u byte batches", batch_max );
+}
+
+static void chan_disconnected ( struct bt_l2cap_chan *chan )
+{
+    atomic_set ( &chan_up, 0 );
+    LOG_INF ( "Stream disconnected, %u batches sent, %u dropped",
+              sent,
+              dropped );
+}
+
+// Nothing is accepted from the peer
+static int chan_recv ( struct bt_l2cap_chan *chan, struct net_buf *buf )
+{
+    return 0;
+}
+
+static void chan_sent ( struct bt_l2cap_chan *chan )
+{
+    sent++;
+}
+
+static const struct bt_l2cap_chan_ops chan_ops = {
+    .connected = chan_connected,
+    .disconnected = chan_disconnected,
+    .recv = chan_recv,
+    .sent = chan_sent,
+};
+
+// One stream at a time
+static int accept ( struct bt_conn *conn, struct bt_l2cap_chan **chan )
+{
+    if ( le_chan.chan.conn ) {
+        return -ENOMEM;
+    }
+    memset ( &le_chan, 0, sizeof ( le_chan ) );
+    le_chan.chan.ops = &chan_ops;
+    le_chan.rx.mtu = STREAM_MTU;
+    *chan = &le_chan.chan;
+    return 0;
+}
+
+static struct bt_l2cap_server server = {
+    .psm = STREAM_PSM,
+    .sec_level = BT_SECURITY_L1,
+    .accept = accept,
+};
+
+static void send_work_handler ( struct k_work *work )
+{
+    struct net_buf *buf;
+    while ( ( buf = net_buf_get ( &ready, K_NO_WAIT ) ) ) {
+        int rc = atomic_get ( &chan_up )
+                     ? bt_l2cap_chan_send ( &le_chan.chan, buf )
+                     : -ENOTCONN;
+        if ( rc < 0 ) {
+            net_buf_unref ( buf );
+            dropped++;
+        }
+    }
+}
+
+// Call with the lock held
+static void close_batch()
+{
+    if ( cur ) {
+        net_buf_put ( &ready, cur );
+        cur = NULL;
+        k_work_submit ( &send_work );
+    }
+}
+
+static void flush_work_handler ( struct k_work *work )
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    close_batch();
+    k_spin_unlock ( &lock, key );
+}
+
+// Never waits, records that find no free batch are lost with it
+void streamRecord ( stream_rec_t rec )
+{
+    if ( !atomic_get ( &chan_up ) ) {
+        return;
+    }
+
+    const uint32_t now_ms = k_uptime_get_32();
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( !cur ) {
+        cur = net_buf_alloc ( &stream_pool, K_NO_WAIT );
+        if ( !cur ) {
+            // Whole batch lost, the seq gap shows it
+            if ( !lost || ( lost_len + sizeof ( rec ) > batch_max )
+                 || ( now_ms - cur_ms >= STREAM_FLUSH_MS ) ) {
+                seq++;
+                dropped++;
+                lost = true;
+                lost_len = sizeof ( stream_batch_t );
+                cur_ms = now_ms;
+            }
+            lost_len += sizeof ( rec );
+            k_spin_unlock ( &lock, key );
+            return;
+        }
+        lost = false;
+        net_buf_reserve ( cur, BT_L2CAP_SDU_CHAN_SEND_RESERVE );
+        stream_batch_t *batch = net_buf_add ( cur, sizeof ( *batch ) );
+        batch->seq = sys_cpu_to_le16 ( seq++ );
+        batch->t_ms = sys_cpu_to_le32 ( now_ms );
+        cur_ms = now_ms;
+        k_work_reschedule ( &flush_work, K_MSEC ( STREAM_FLUSH_MS ) );
+    }
+
+    rec.dt_ms = sys_cpu_to_le16 ( now_ms - cur_ms );
+    rec.value = sys_cpu_to_le16 ( rec.value );
+    rec.rtt_us = sys_cpu_to_le16 ( rec.rtt_us );
+    net_buf_add_mem ( cur, &rec, sizeof ( rec ) );
+    if ( cur->len + sizeof ( rec ) > batch_max ) {
+        close_batch();
+    }
+    k_spin_unlock ( &lock, key );
+}
+
+static int stream_init ( const struct device *dev )
+{
+    ARG_UNUSED ( dev );
+
+    int err = bt_l2cap_server_register ( &server );
+    if ( err ) {
+        LOG_ERR ( "Stream server failed to register (err %d)", err );
+    }
+    return err;
+}
+
+SYS_INIT ( stream_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY );
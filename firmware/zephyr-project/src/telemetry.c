@@ -0,0 +1,464 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "telemetry.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "cycles.h"
+#include "link.h"
+
+LOG_MODULE_REGISTER ( telemetry );
+
+// Controller state of one connection
+typedef struct
+{
+    struct bt_conn *conn;
+    uint8_t in_flight;
+    uint8_t head;  // Oldest submit time
+    uint32_t submit_ms [TELEMETRY_MAX_IN_FLIGHT];
+    uint32_t connect_ms;
+    bool bonded;
+    bool first_done;
+} link_t;
+
+static void publish_work_handler ( struct k_work *work );
+K_WORK_DELAYABLE_DEFINE ( publish_work, publish_work_handler );
+
+static telemetry_chan_t *chans [TELEMETRY_MAX_CHANS];
+static size_t chan_cnt = 0;
+static link_t links [CONFIG_BT_MAX_CONN];
+static struct k_spinlock lock;
+static bike_data_t snapshot;
+static uint32_t snapshot_seq = 0;
+static telemetry_stats_t stats = {};
+static atomic_t paused = ATOMIC_INIT ( 0 );
+
+// Call from the service init, resolves the attribute once
+int telemetryRegister ( telemetry_chan_t *chan,
+                        const struct bt_gatt_service_static *svc,
+                        const struct bt_uuid *uuid )
+{
+    if ( chan_cnt >= TELEMETRY_MAX_CHANS ) {
+        LOG_ERR ( "No room for telemetry channel %s!", chan->name );
+        return -ENOMEM;
+    }
+    stats.cyc_hz = cyclesInit();
+    chan->attr = bt_gatt_find_by_uuid ( svc->attrs, svc->attr_count, uuid );
+    if ( !chan->attr ) {
+        LOG_ERR ( "Attribute for telemetry channel %s not found!", chan->name );
+        return -ENOENT;
+    }
+    chans [chan_cnt++] = chan;
+    return 0;
+}
+
+static void connected ( struct bt_conn *conn, uint8_t err )
+{
+    if ( err || !linkIsPeripheral ( conn ) ) {
+        return;
+    }
+
+    // Fresh connections start with clean rate, dedupe and budget state
+    const uint8_t idx = bt_conn_index ( conn );
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    memset ( &links [idx], 0, sizeof ( link_t ) );
+    links [idx].conn = bt_conn_ref ( conn );
+    links [idx].connect_ms = k_uptime_get_32();
+    links [idx].bonded
+        = bt_addr_le_is_bonded ( BT_ID_DEFAULT, bt_conn_get_dst ( conn ) );
+    for ( size_t i = 0; i < chan_cnt; i++ ) {
+        memset ( &chans [i]->subs [idx], 0, sizeof ( telemetry_sub_t ) );
+    }
+    k_spin_unlock ( &lock, key );
+}
+
+static void disconnected ( struct bt_conn *conn, uint8_t reason )
+{
+    const uint8_t idx = bt_conn_index ( conn );
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    struct bt_conn *old = links [idx].conn;
+    links [idx].conn = NULL;
+    for ( size_t i = 0; i < chan_cnt; i++ ) {
+        if ( chans [i]->subs [idx].pending ) {
+            chans [i]->subs [idx].pending = false;
+            stats.dropped++;
+        }
+    }
+    k_spin_unlock ( &lock, key );
+    if ( old ) {
+        bt_conn_unref ( old );
+    }
+}
+
+BT_CONN_CB_DEFINE ( telemetry_conn_callbacks )
+    = { .connected = connected, .disconnected = disconnected };
+
+// Largest notification payload the connection takes
+static size_t pdu_len ( struct bt_conn *conn )
+{
+    const size_t len = bt_gatt_get_mtu ( conn ) - 3;
+    return len < TELEMETRY_MAX_LEN ? len : TELEMETRY_MAX_LEN;
+}
+
+static uint16_t clip_ms ( uint32_t ms )
+{
+    return ms > UINT16_MAX ? UINT16_MAX : ms;
+}
+
+// Age of the bus reading behind what just went out
+static void track_age ( const bike_data_t *data, uint32_t now_ms )
+{
+    stats.age_last_ms = clip_ms ( now_ms - data->rpm_ms );
+    stats.age_avg_ms = ( 7 * stats.age_avg_ms + stats.age_last_ms ) / 8;
+    if ( stats.age_last_ms > stats.age_max_ms ) {
+        stats.age_max_ms = stats.age_last_ms;
+    }
+    if ( data->stale ) {
+        stats.stale++;
+    }
+}
+
+// Bonded peers with cached CCC state should be much faster than new ones
+static void track_first_notify ( link_t *link, uint32_t now_ms )
+{
+    link->first_done = true;
+    const uint16_t ms = clip_ms ( now_ms - link->connect_ms );
+    if ( link->bonded ) {
+        stats.first_bonded_ms = ms;
+    } else {
+        stats.first_new_ms = ms;
+    }
+}
+
+// Completions arrive in submit order per connection
+static void notify_complete ( struct bt_conn *conn, void *user_data )
+{
+    const uint32_t now_ms = k_uptime_get_32();
+    link_t *link = &links [bt_conn_index ( conn )];
+
+    // Late completions from a previous connection on this slot don't
+    // belong to the reset budget
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( link->conn != conn ) {
+        k_spin_unlock ( &lock, key );
+        return;
+    }
+    const bool first = !link->first_done;
+    const bool bonded = link->bonded;
+    if ( first ) {
+        track_first_notify ( link, now_ms );
+    }
+    if ( link->in_flight ) {
+        const uint32_t lat_ms = now_ms - link->submit_ms [link->head];
+        link->head = ( link->head + 1 ) % TELEMETRY_MAX_IN_FLIGHT;
+        link->in_flight--;
+        stats.completed++;
+        stats.lat_last_ms = clip_ms ( lat_ms );
+        stats.lat_avg_ms = ( 7 * stats.lat_avg_ms + stats.lat_last_ms ) / 8;
+        if ( stats.lat_last_ms > stats.lat_max_ms ) {
+            stats.lat_max_ms = stats.lat_last_ms;
+        }
+    }
+    k_spin_unlock ( &lock, key );
+
+    if ( first ) {
+        LOG_INF ( "First notification %u ms after connecting (%s peer)",
+                  clip_ms ( now_ms - link->connect_ms ),
+                  bonded ? "bonded" : "new" );
+    }
+
+    // Freed budget, flush anything pending
+    k_work_reschedule ( &publish_work, K_NO_WAIT );
+}
+
+// Returns 0 when the payload is queued in the controller, conn is the
+// reference held for this cycle since link->conn can be cleared meanwhile
+static int submit ( const telemetry_chan_t *chan,
+                    telemetry_sub_t *sub,
+                    link_t *link,
+                    struct bt_conn *conn,
+                    const uint8_t *buf,
+                    size_t len,
+                    uint32_t now_ms )
+{
+    if ( link->in_flight >= TELEMETRY_MAX_IN_FLIGHT ) {
+        return -EBUSY;
+    }
+
+    struct bt_gatt_notify_params params = {
+        .attr = chan->attr,
+        .data = buf,
+        .len = len,
+        .func = notify_complete,
+    };
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( link->conn != conn ) {
+        k_spin_unlock ( &lock, key );
+        return -ENOTCONN;
+    }
+    const uint8_t slot
+        = ( link->head + link->in_flight ) % TELEMETRY_MAX_IN_FLIGHT;
+    link->submit_ms [slot] = now_ms;
+    link->in_flight++;
+    k_spin_unlock ( &lock, key );
+
+    int rc = bt_gatt_notify_cb ( conn, &params );
+    if ( rc ) {
+        key = k_spin_lock ( &lock );
+        link->in_flight--;
+        k_spin_unlock ( &lock, key );
+        return rc;
+    }
+    memcpy ( sub->last, buf, len );
+    sub->len = len;
+    sub->sent_ms = now_ms;
+    sub->sent++;
+    stats.sent++;
+    return 0;
+}
+
+// Newest payload wins the pending slot
+static void set_pending ( telemetry_sub_t *sub, const uint8_t *buf, size_t len )
+{
+    if ( sub->pending ) {
+        stats.coalesced++;
+    }
+    memcpy ( sub->pend, buf, len );
+    sub->pend_len = len;
+    sub->pending = true;
+}
+
+static void flush_pending ( link_t *link,
+                            struct bt_conn *conn,
+                            uint8_t idx,
+                            uint32_t now_ms )
+{
+    for ( size_t i = 0; i < chan_cnt; i++ ) {
+        telemetry_sub_t *sub = &chans [i]->subs [idx];
+        if ( !sub->pending ) {
+            continue;
+        }
+        int rc = submit (
+            chans [i], sub, link, conn, sub->pend, sub->pend_len, now_ms );
+        if ( rc == -EBUSY || rc == -ENOMEM ) {
+            return;
+        }
+        if ( rc && ( rc != -ENOTCONN ) ) {
+            LOG_WRN ( "Failed to notify %s: %d", chans [i]->name, rc );
+            stats.dropped++;
+        }
+        sub->pending = false;
+    }
+}
+
+static bool is_due ( const telemetry_chan_t *chan,
+                     const telemetry_sub_t *sub,
+                     uint32_t seq,
+                     uint32_t now_ms )
+{
+    if ( chan->event ) {
+        // Quiet channels still refresh so clients see the link is live
+        return ( sub->seq != seq )
+               || ( now_ms - sub->sent_ms >= TELEMETRY_REFRESH_MS );
+    } else if ( chan->period_ms == TELEMETRY_ON_SAMPLE ) {
+        return sub->seq != seq;
+    }
+    return ( int32_t )( now_ms - sub->due_ms ) >= 0;
+}
+
+static void publish_sub ( const telemetry_chan_t *chan,
+                          telemetry_sub_t *sub,
+                          link_t *link,
+                          struct bt_conn *conn,
+                          const uint8_t *buf,
+                          size_t len,
+                          uint32_t seq,
+                          uint32_t now_ms )
+{
+    sub->seq = seq;
+    sub->due_ms = now_ms + chan->period_ms;
+    if ( !len ) {
+        return;
+    }
+
+    // Skip repeats until the refresh interval runs out
+    if ( !sub->pending && ( len == sub->len ) && !memcmp ( buf, sub->last, len )
+         && ( now_ms - sub->sent_ms < TELEMETRY_REFRESH_MS ) ) {
+        stats.skipped++;
+        return;
+    }
+
+    // Anything already waiting is older, so it gets replaced
+    if ( sub->pending ) {
+        set_pending ( sub, buf, len );
+        return;
+    }
+
+    int rc = submit ( chan, sub, link, conn, buf, len, now_ms );
+    if ( rc == -EBUSY || rc == -ENOMEM ) {
+        set_pending ( sub, buf, len );
+    } else if ( rc && ( rc != -ENOTCONN ) ) {
+        LOG_WRN ( "Failed to notify %s: %d", chan->name, rc );
+        stats.dropped++;
+    }
+}
+
+// Encodes once per channel and payload size, then fans out to due
+// subscribers
+static void publish_chan ( telemetry_chan_t *chan,
+                           link_t *const active [],
+                           struct bt_conn *const held [],
+                           const bike_data_t *data,
+                           uint32_t seq,
+                           uint32_t now_ms )
+{
+    uint8_t buf [TELEMETRY_MAX_LEN];
+    size_t len = 0;
+    size_t enc_max = 0;
+    if ( chan->event ) {
+        seq = chan->event ( data );
+    }
+    for ( size_t i = 0; i < CONFIG_BT_MAX_CONN; i++ ) {
+        telemetry_sub_t *sub = &chan->subs [i];
+        if ( !active [i]
+             || !bt_gatt_is_subscribed (
+                 held [i], chan->attr, BT_GATT_CCC_NOTIFY )
+             || !is_due ( chan, sub, seq, now_ms ) ) {
+            continue;
+        }
+        const size_t max = pdu_len ( held [i] );
+        if ( max != enc_max ) {
+            len = chan->encode ( data, buf, max );
+            enc_max = max;
+        }
+        publish_sub ( chan, sub, active [i], held [i], buf, len, seq, now_ms );
+    }
+}
+
+static void publish_work_handler ( struct k_work *work )
+{
+    const uint64_t start_cyc = cyclesNow();
+    const uint32_t now_ms = k_uptime_get_32();
+
+    // Every channel encodes from the same snapshot, connections are held
+    // so they can't go away mid fan-out
+    link_t *active [CONFIG_BT_MAX_CONN];
+    struct bt_conn *held [CONFIG_BT_MAX_CONN];
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    const bike_data_t data = snapshot;
+    const uint32_t seq = snapshot_seq;
+    for ( size_t i = 0; i < CONFIG_BT_MAX_CONN; i++ ) {
+        held [i] = links [i].conn ? bt_conn_ref ( links [i].conn ) : NULL;
+        active [i] = held [i] ? &links [i] : NULL;
+    }
+    k_spin_unlock ( &lock, key );
+
+    // Paused cycles keep the schedule but leave the link alone
+    if ( !atomic_get ( &paused ) ) {
+        const uint32_t sent = stats.sent;
+        for ( size_t i = 0; i < CONFIG_BT_MAX_CONN; i++ ) {
+            if ( active [i] ) {
+                flush_pending ( active [i], held [i], i, now_ms );
+            }
+        }
+        for ( size_t i = 0; i < chan_cnt; i++ ) {
+            publish_chan ( chans [i], active, held, &data, seq, now_ms );
+        }
+        if ( stats.sent != sent ) {
+            track_age ( &data, now_ms );
+        }
+    }
+
+    for ( size_t i = 0; i < CONFIG_BT_MAX_CONN; i++ ) {
+        if ( held [i] ) {
+            bt_conn_unref ( held [i] );
+        }
+    }
+
+    stats.last_cyc = cyclesSince ( start_cyc );
+    if ( stats.last_cyc > stats.max_cyc ) {
+        stats.max_cyc = stats.last_cyc;
+    }
+    k_work_schedule ( &publish_work, K_MSEC ( TELEMETRY_TICK_MS ) );
+}
+
+// Call once per sample, channels are serviced from the system work queue
+void telemetryPublish ( const bike_data_t *data )
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    const uint32_t revs = snapshot.crank_revs;
+    const uint32_t evt_1024 = snapshot.crank_evt_1024;
+    snapshot = *data;
+    snapshot_seq++;
+
+    // The crank event work may have published a later revolution since
+    // this sample was taken
+    if ( ( int32_t )( data->crank_revs - revs ) < 0 ) {
+        snapshot.crank_revs = revs;
+        snapshot.crank_evt_1024 = evt_1024;
+    }
+    k_spin_unlock ( &lock, key );
+    k_work_reschedule ( &publish_work, K_NO_WAIT );
+}
+
+// Crank event between samples, only the event channels see a change
+void telemetryPublishCrank ( uint32_t revs, uint32_t evt_1024 )
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( ( int32_t )( revs - snapshot.crank_revs ) > 0 ) {
+        snapshot.crank_revs = revs;
+        snapshot.crank_evt_1024 = evt_1024;
+    }
+    k_spin_unlock ( &lock, key );
+    k_work_reschedule ( &publish_work, K_NO_WAIT );
+}
+
+// Latest published sample, for consumers outside the channel table
+bike_data_t telemetryGetSnapshot()
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    const bike_data_t data = snapshot;
+    k_spin_unlock ( &lock, key );
+    return data;
+}
+
+// Leaves the link to bulk transfers, pending payloads wait it out
+void telemetryPause ( bool pause )
+{
+    atomic_set ( &paused, pause );
+    if ( !pause ) {
+        k_work_reschedule ( &publish_work, K_NO_WAIT );
+    }
+}
+
+bool telemetryPaused()
+{
+    return atomic_get ( &paused );
+}
+
+telemetry_stats_t telemetryGetStats()
+{
+    return stats;
+}
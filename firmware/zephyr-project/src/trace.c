@@ -0,0 +1,142 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "trace.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+LOG_MODULE_REGISTER ( trace );
+
+typedef struct
+{
+    uint16_t id;
+    uint8_t marked;  // Bit per mark
+    uint32_t cyc [TRACE_MARKS];
+} trace_slot_t;
+
+// Marks come from the RX thread, the system work queue and the main loop
+static struct k_spinlock lock;
+static trace_slot_t slots [TRACE_SLOTS];
+static uint16_t next_id = 0;
+static trace_stats_t stats = {};
+
+static trace_slot_t *find ( uint16_t id )
+{
+    for ( size_t i = 0; id && ( i < TRACE_SLOTS ); i++ ) {
+        if ( slots [i].id == id ) {
+            return &slots [i];
+        }
+    }
+    return NULL;
+}
+
+static uint8_t bin ( uint32_t us )
+{
+    uint8_t b = 0;
+    uint32_t edge = TRACE_BIN0_US;
+    while ( ( us >= edge ) && ( b < TRACE_BINS - 1 ) ) {
+        edge <<= 1;
+        b++;
+    }
+    return b;
+}
+
+static void add ( uint8_t stage, uint32_t cyc )
+{
+    const uint32_t us = k_cyc_to_us_floor32 ( cyc );
+    const uint8_t b = bin ( us );
+    stats.last_us [stage] = us;
+    if ( stats.hist [stage][b] < UINT16_MAX ) {
+        stats.hist [stage][b]++;
+    }
+}
+
+// Stages whose marks were skipped count as zero
+static void complete ( trace_slot_t *slot )
+{
+    uint32_t prev = slot->cyc [TRACE_RX];
+    for ( uint8_t m = TRACE_RX + 1; m < TRACE_MARKS; m++ ) {
+        if ( !( slot->marked & BIT ( m ) ) ) {
+            slot->cyc [m] = prev;
+        }
+        add ( m - 1, slot->cyc [m] - prev );
+        prev = slot->cyc [m];
+    }
+    add ( TRACE_TOTAL, slot->cyc [TRACE_ACKED] - slot->cyc [TRACE_RX] );
+    stats.completed++;
+    LOG_DBG ( "Trace %u: %u us", slot->id, stats.last_us [TRACE_TOTAL] );
+    slot->id = 0;
+}
+
+// Tags a new command, IDs are never 0 so 0 can mean untraced
+uint16_t traceStart()
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    if ( !++next_id ) {
+        next_id = 1;
+    }
+    trace_slot_t *slot = &slots [next_id % TRACE_SLOTS];
+    if ( slot->id ) {
+        stats.dropped++;
+    }
+    slot->id = next_id;
+    slot->marked = BIT ( TRACE_RX );
+    slot->cyc [TRACE_RX] = k_cycle_get_32();
+    stats.started++;
+    const uint16_t id = next_id;
+    k_spin_unlock ( &lock, key );
+    return id;
+}
+
+// Marking again moves the mark, so the last try wins
+void traceMark ( uint16_t id, traceMark_t mark )
+{
+    const uint32_t now_cyc = k_cycle_get_32();
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    trace_slot_t *slot = find ( id );
+    if ( slot ) {
+        slot->cyc [mark] = now_cyc;
+        slot->marked |= BIT ( mark );
+        if ( mark == TRACE_ACKED ) {
+            complete ( slot );
+        }
+    }
+    k_spin_unlock ( &lock, key );
+}
+
+void traceDrop ( uint16_t id )
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    trace_slot_t *slot = find ( id );
+    if ( slot ) {
+        slot->id = 0;
+        stats.dropped++;
+    }
+    k_spin_unlock ( &lock, key );
+}
+
+trace_stats_t traceGetStats()
+{
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    const trace_stats_t copy = stats;
+    k_spin_unlock ( &lock, key );
+    return copy;
+}
@@ -0,0 +1,252 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "workout.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include "bikeControl.h"
+#include "erg.h"
+#include "ftms.h"
+#include "sim.h"
+
+LOG_MODULE_REGISTER ( workout );
+
+// Built in library, const so it lives in flash
+static const workout_seg_t HILLS_SEGS [] = {
+    WORKOUT_ERG ( WORKOUT_MIN ( 5 ), 120 ),
+    WORKOUT_GRADE ( WORKOUT_MIN ( 8 ), 200 ),
+    WORKOUT_GRADE ( WORKOUT_MIN ( 10 ), 600 ),
+    WORKOUT_GRADE ( WORKOUT_MIN ( 12 ), 0 ),
+    WORKOUT_GRADE ( WORKOUT_MIN ( 14 ), 800 ),
+    WORKOUT_GRADE ( WORKOUT_MIN ( 16 ), 0 ),
+    WORKOUT_GRADE ( WORKOUT_MIN ( 18 ), 1000 ),
+    WORKOUT_ERG ( WORKOUT_MIN ( 23 ), 100 ),
+};
+
+static const workout_t WORKOUTS [] = {
+    { "Hills", HILLS_SEGS, ARRAY_SIZE ( HILLS_SEGS ) },
+};
+
+// Uploaded workout, records are converted once when loaded
+static workout_rec_t stored_recs [WORKOUT_MAX_SEGS];
+static workout_seg_t stored_segs [WORKOUT_MAX_SEGS];
+static uint8_t stored_cnt = 0;
+static struct k_spinlock lock;
+
+// A running workout keeps its own copy so an upload can't change it
+static workout_seg_t run_segs [WORKOUT_MAX_SEGS];
+static workout_t run = { "Uploaded", run_segs, 0 };
+
+static const workout_t *active = NULL;
+static uint32_t start_ms = 0;
+static uint8_t seg = 0;
+static bool prepositioned = false;
+static atomic_t toggle_req = ATOMIC_INIT ( 0 );
+
+static void apply_segment ( const workout_seg_t *s )
+{
+    bike_tgts_t tgts = BIKE_TGTS_NONE;
+    if ( s->type == SEG_ERG ) {
+        LOG_INF ( "Segment %u: %d W", seg + 1, s->target );
+        tgts.power = s->target;
+    } else {
+        LOG_INF ( "Segment %u: %d grade", seg + 1, s->target );
+        tgts.incline = s->target;
+        tgts.crr = SIM_DEFAULT_CRR;
+        tgts.cw = SIM_DEFAULT_CW;
+    }
+    updateBikeTgts ( tgts );
+}
+
+// Same limits the FTMS control point advertises and enforces
+static bool target_valid ( uint8_t type, int16_t target )
+{
+    if ( type == SEG_ERG ) {
+        return ( target >= ERG_MIN_WATTS ) && ( target <= ERG_MAX_WATTS );
+    } else if ( type == SEG_GRADE ) {
+        return ( target >= FTMS_INC_MIN_TENTH_PCT * 10 )
+               && ( target <= FTMS_INC_MAX_TENTH_PCT * 10 );
+    }
+    return false;
+}
+
+static int install ( const workout_rec_t *recs, uint8_t cnt )
+{
+    if ( !cnt || ( cnt > WORKOUT_MAX_SEGS ) ) {
+        return -EINVAL;
+    }
+    uint32_t prev_s = 0;
+    for ( uint8_t i = 0; i < cnt; i++ ) {
+        const uint32_t end_s = sys_le32_to_cpu ( recs [i].end_s );
+        const int16_t target = sys_le16_to_cpu ( recs [i].target );
+        if ( ( end_s <= prev_s ) || !target_valid ( recs [i].type, target ) ) {
+            return -EINVAL;
+        }
+        prev_s = end_s;
+    }
+
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    for ( uint8_t i = 0; i < cnt; i++ ) {
+        stored_recs [i] = recs [i];
+        stored_segs [i].end_s = sys_le32_to_cpu ( recs [i].end_s );
+        stored_segs [i].type = recs [i].type;
+        stored_segs [i].target = sys_le16_to_cpu ( recs [i].target );
+    }
+    stored_cnt = cnt;
+    k_spin_unlock ( &lock, key );
+    return 0;
+}
+
+#ifdef CONFIG_SETTINGS
+// Flash writes stay off the BT RX thread
+static void save_work_handler ( struct k_work *work )
+{
+    static workout_rec_t recs [WORKOUT_MAX_SEGS];
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    const uint8_t cnt = stored_cnt;
+    memcpy ( recs, stored_recs, cnt * sizeof ( recs [0] ) );
+    k_spin_unlock ( &lock, key );
+
+    int err
+        = settings_save_one ( "workout/segs", recs, cnt * sizeof ( recs [0] ) );
+    if ( err ) {
+        LOG_ERR ( "Workout save failed (err %d)", err );
+    }
+}
+
+static K_WORK_DEFINE ( save_work, save_work_handler );
+
+static int settings_set ( const char *name,
+                          size_t len,
+                          settings_read_cb read_cb,
+                          void *cb_arg )
+{
+    static workout_rec_t recs [WORKOUT_MAX_SEGS];
+    const char *next;
+    if ( !settings_name_steq ( name, "segs", &next ) || next ) {
+        return -ENOENT;
+    }
+    if ( ( len > sizeof ( recs ) ) || ( len % sizeof ( recs [0] ) ) ) {
+        return -EINVAL;
+    }
+    ssize_t rc = read_cb ( cb_arg, recs, len );
+    if ( rc < 0 ) {
+        return rc;
+    }
+    rc = install ( recs, len / sizeof ( recs [0] ) );
+    if ( !rc ) {
+        LOG_INF ( "Loaded %u segment workout", stored_cnt );
+    }
+    return rc;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE (
+    workout, "workout", NULL, settings_set, NULL, NULL );
+#endif
+
+// Validates and stores an uploaded workout, replaces the previous one
+int workoutLoad ( const workout_rec_t *recs, uint8_t cnt )
+{
+    int err = install ( recs, cnt );
+    if ( err ) {
+        LOG_WRN ( "Workout rejected (err %d)", err );
+        return err;
+    }
+    LOG_INF ( "Workout uploaded: %u segments", cnt );
+#ifdef CONFIG_SETTINGS
+    k_work_submit ( &save_work );
+#endif
+    return 0;
+}
+
+// Safe from any context, applied on the next update
+void workoutToggle()
+{
+    atomic_set ( &toggle_req, 1 );
+}
+
+bool workoutActive()
+{
+    return active != NULL;
+}
+
+static void handle_toggle ( uint32_t now_ms )
+{
+    if ( active ) {
+        LOG_INF ( "Stopping workout: %s", active->name );
+        active = NULL;
+        ftmsStatusUser ( false );
+        return;
+    }
+    // Uploaded workout wins over the built in one
+    k_spinlock_key_t key = k_spin_lock ( &lock );
+    run.cnt = stored_cnt;
+    memcpy ( run_segs, stored_segs, stored_cnt * sizeof ( run_segs [0] ) );
+    k_spin_unlock ( &lock, key );
+    active = run.cnt ? &run : &WORKOUTS [0];
+    start_ms = now_ms;
+    seg = 0;
+    prepositioned = false;
+    LOG_INF ( "Starting workout: %s", active->name );
+    ftmsStatusUser ( true );
+    apply_segment ( &active->segs [seg] );
+}
+
+// Call once per cycle, only walks forward through the timeline
+void workoutUpdate ( uint32_t now_ms )
+{
+    if ( atomic_cas ( &toggle_req, 1, 0 ) ) {
+        handle_toggle ( now_ms );
+    }
+    if ( !active ) {
+        return;
+    }
+
+    const uint32_t elapsed_ms = now_ms - start_ms;
+    if ( elapsed_ms >= active->segs [seg].end_s * 1000 ) {
+        if ( ++seg >= active->cnt ) {
+            LOG_INF ( "Workout complete: %s", active->name );
+            active = NULL;
+            ftmsStatusUser ( false );
+            return;
+        }
+        prepositioned = false;
+        apply_segment ( &active->segs [seg] );
+    }
+
+    // Start the slow incline motor early so it lands on the boundary
+    const workout_seg_t *next
+        = seg + 1 < active->cnt ? &active->segs [seg + 1] : NULL;
+    if ( !next || ( next->type != SEG_GRADE ) || prepositioned ) {
+        return;
+    }
+    const uint32_t left_ms = active->segs [seg].end_s * 1000 - elapsed_ms;
+    if ( left_ms <= inclineTravelMs ( next->target ) + WORKOUT_LEAD_MS ) {
+        prepositionIncline ( next->target );
+        prepositioned = true;
+    }
+}
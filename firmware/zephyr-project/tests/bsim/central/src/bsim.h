@@ -0,0 +1,75 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BSIM_H
+#define BSIM_H
+
+#include <stddef.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/types.h>
+
+#include "bs_tracing.h"
+#include "bs_types.h"
+#include "bstests.h"
+
+extern enum bst_result_t bst_result;
+
+#define FAIL( ... )                               \
+    do {                                          \
+        bst_result = Failed;                      \
+        bs_trace_error_time_line ( __VA_ARGS__ ); \
+    } while ( 0 )
+
+#define PASS( ... )                            \
+    do {                                       \
+        bst_result = Passed;                   \
+        bs_trace_info_time ( 1, __VA_ARGS__ ); \
+    } while ( 0 )
+
+// Whole run in simulated time, a device still going after this fails
+#define TEST_TIMEOUT_US ( 50 * 1000000ULL )
+
+// Longest wait for a single GATT procedure
+#define GATT_TIMEOUT_MS 5000
+
+// Heart rate the strap cycles through, once a second
+#define STRAP_BPM_MIN 120
+#define STRAP_BPM_MAX 129
+
+void testInit();
+void testTick ( bs_time_t now );
+
+void bleStart();
+struct bt_conn *connectBike();
+uint16_t findChar ( struct bt_conn *conn, const struct bt_uuid *uuid );
+void subscribeChar ( struct bt_conn *conn,
+                     struct bt_gatt_subscribe_params *params );
+size_t readChar ( struct bt_conn *conn,
+                  uint16_t handle,
+                  void *buf,
+                  size_t len );
+
+struct bst_test_list *testCentralInstall ( struct bst_test_list *tests );
+struct bst_test_list *testObserverInstall ( struct bst_test_list *tests );
+struct bst_test_list *testStrapInstall ( struct bst_test_list *tests );
+struct bst_test_list *testUploadInstall ( struct bst_test_list *tests );
+
+#endif  // BSIM_H
@@ -0,0 +1,395 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bsim.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+
+#include "cps.h"
+#include "cscs.h"
+#include "diag.h"
+#include "fec.h"
+#include "ftms.h"
+#include "telemetry.h"
+
+// Counted from the first control write to the diagnostics read
+#define MEASURE_MS 30000
+
+// Target power steps, alternating so every write changes the bike
+#define CTRL_PERIOD_MS 1000
+#define CTRL_LOW_W 150
+#define CTRL_HIGH_W 200
+#define CTRL_TIMEOUT_MS 3000
+
+// Submit to completion the apps should still see with a strap connected,
+// a few 30 ms connection intervals
+#define HR_LAT_BUDGET_MS 100
+
+typedef struct
+{
+    uint32_t cnt;
+    uint32_t sum_ms;
+    uint32_t max_ms;
+} lat_t;
+
+typedef struct
+{
+    uint32_t cnt;
+    uint32_t missed;  // Crank revolutions skipped between notifications
+    uint16_t revs;
+    bool seen;
+} chan_t;
+
+static struct bt_conn *bike = NULL;
+static bool measuring = false;
+static chan_t ftms;
+static chan_t cps;
+static chan_t cscs;
+static lat_t crank_lat;
+static uint32_t hr_cnt = 0;
+static uint8_t hr_bpm = 0xFF;
+
+static K_SEM_DEFINE ( ctrl_sem, 0, 1 );
+static uint16_t ctrl_handle = 0;
+static uint32_t ctrl_tx_ms = 0;
+static uint8_t ctrl_op = 0;
+static uint8_t ctrl_result = 0;
+static uint32_t ctrl_sent = 0;
+static uint32_t ctrl_lost = 0;
+static uint32_t ctrl_refused = 0;
+static lat_t ctrl_rtt;
+
+static void lat_add ( lat_t *lat, uint32_t ms )
+{
+    lat->cnt++;
+    lat->sum_ms += ms;
+    lat->max_ms = MAX ( lat->max_ms, ms );
+}
+
+static uint32_t lat_avg ( const lat_t *lat )
+{
+    return lat->cnt ? lat->sum_ms / lat->cnt : 0;
+}
+
+// Devices boot together, so both uptimes are simulation time and the
+// event timestamp in the payload gives the crank event to air latency
+static void crank_event ( chan_t *chan, uint16_t revs, uint16_t evt_1024 )
+{
+    if ( chan->seen && ( revs != chan->revs ) ) {
+        const uint16_t gap = revs - chan->revs;
+        chan->missed += gap - 1;
+        const uint16_t now_1024 = ( k_uptime_get() * 128 ) / 125;
+        lat_add ( &crank_lat, ( uint16_t )( now_1024 - evt_1024 ) * 125 / 128 );
+    }
+    chan->revs = revs;
+    chan->seen = true;
+}
+
+static uint8_t ftms_data ( struct bt_conn *conn,
+                           struct bt_gatt_subscribe_params *params,
+                           const void *data,
+                           uint16_t length )
+{
+    if ( !data ) {
+        return BT_GATT_ITER_STOP;
+    } else if ( measuring ) {
+        ftms.cnt++;
+    }
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static uint8_t cps_data ( struct bt_conn *conn,
+                          struct bt_gatt_subscribe_params *params,
+                          const void *data,
+                          uint16_t length )
+{
+    const ble_cps_measurement_data_t *meas = data;
+    if ( !data ) {
+        return BT_GATT_ITER_STOP;
+    } else if ( measuring && ( length >= sizeof ( *meas ) ) ) {
+        cps.cnt++;
+        crank_event ( &cps,
+                      sys_le16_to_cpu ( meas->totalRevs_cnt ),
+                      sys_le16_to_cpu ( meas->lastCrank_1024 ) );
+    }
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static uint8_t cscs_data ( struct bt_conn *conn,
+                           struct bt_gatt_subscribe_params *params,
+                           const void *data,
+                           uint16_t length )
+{
+    const ble_cscs_measurement_data_t *meas = data;
+    if ( !data ) {
+        return BT_GATT_ITER_STOP;
+    } else if ( measuring && ( length >= sizeof ( *meas ) ) ) {
+        cscs.cnt++;
+        crank_event ( &cscs,
+                      sys_le16_to_cpu ( meas->totalRevs_cnt ),
+                      sys_le16_to_cpu ( meas->lastCrank_1024 ) );
+    }
+    return BT_GATT_ITER_CONTINUE;
+}
+
+// FE-C General FE Data carries the strap's heart rate
+static uint8_t fec_data ( struct bt_conn *conn,
+                          struct bt_gatt_subscribe_params *params,
+                          const void *data,
+                          uint16_t length )
+{
+    const tx_msg_t *msg = data;
+    const fec_general_fe_data_t *pg = ( const void * )msg->data;
+    if ( !data ) {
+        return BT_GATT_ITER_STOP;
+    } else if ( measuring && ( length >= FEC_MSG_LEN )
+                && ( pg->page == FEC_GENERAL_FE_DATA_PG ) ) {
+        hr_cnt++;
+        hr_bpm = pg->heartrate;
+    }
+    return BT_GATT_ITER_CONTINUE;
+}
+
+// Procedure complete indication, written to answered
+static uint8_t ctrl_data ( struct bt_conn *conn,
+                           struct bt_gatt_subscribe_params *params,
+                           const void *data,
+                           uint16_t length )
+{
+    const ctrl_point_resp_t *resp = data;
+    if ( !data ) {
+        return BT_GATT_ITER_STOP;
+    } else if ( ( length < sizeof ( *resp ) )
+                || ( resp->resp_op != OPCODE_RESPONSE )
+                || ( resp->req_op != ctrl_op ) ) {
+        return BT_GATT_ITER_CONTINUE;
+    }
+    lat_add ( &ctrl_rtt, k_uptime_get_32() - ctrl_tx_ms );
+    ctrl_result = resp->result;
+    k_sem_give ( &ctrl_sem );
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static void ctrl_written ( struct bt_conn *conn,
+                           uint8_t err,
+                           struct bt_gatt_write_params *params )
+{
+    if ( err ) {
+        FAIL ( "Control point write failed (ATT err 0x%02x)\n", err );
+    }
+}
+
+// Only the first central gets control, the others are still answered
+static void write_ctrl ( uint8_t op, const void *param, size_t len )
+{
+    static uint8_t buf [8];
+    static struct bt_gatt_write_params params;
+    buf [0] = op;
+    if ( len ) {
+        memcpy ( &buf [1], param, len );
+    }
+    params.func = ctrl_written;
+    params.handle = ctrl_handle;
+    params.offset = 0;
+    params.data = buf;
+    params.length = len + 1;
+
+    ctrl_op = op;
+    ctrl_tx_ms = k_uptime_get_32();
+    ctrl_sent++;
+    int err = bt_gatt_write ( bike, &params );
+    if ( err ) {
+        FAIL ( "Control point write failed to start (err %d)\n", err );
+    }
+    if ( k_sem_take ( &ctrl_sem, K_MSEC ( CTRL_TIMEOUT_MS ) ) ) {
+        ctrl_lost++;
+    } else if ( ctrl_result != OPCODE_SUCCESS ) {
+        ctrl_refused++;
+    }
+}
+
+static void subscribe ( struct bt_gatt_subscribe_params *params,
+                        const struct bt_uuid *uuid,
+                        uint16_t value,
+                        bt_gatt_notify_func_t func )
+{
+    params->value_handle = findChar ( bike, uuid );
+    params->value = value;
+    params->notify = func;
+    subscribeChar ( bike, params );
+}
+
+static uint32_t rate_x100 ( uint32_t cnt, uint32_t ms )
+{
+    return ms ? ( uint64_t )cnt * 100000 / ms : 0;
+}
+
+// One line per central, read by the run scripts
+static void report ( const telemetry_stats_t *stats, uint32_t ms )
+{
+    const uint32_t ftms_hz = rate_x100 ( ftms.cnt, ms );
+    const uint32_t cps_hz = rate_x100 ( cps.cnt, ms );
+    const uint32_t cscs_hz = rate_x100 ( cscs.cnt, ms );
+    printk ( "RESULT ftms_hz=%u.%02u cps_hz=%u.%02u cscs_hz=%u.%02u"
+             " crank_lat_avg_ms=%u crank_lat_max_ms=%u crank_missed=%u"
+             " ctrl_sent=%u ctrl_lost=%u ctrl_refused=%u"
+             " ctrl_rtt_avg_ms=%u ctrl_rtt_max_ms=%u hr_bpm=%u\n",
+             ftms_hz / 100,
+             ftms_hz % 100,
+             cps_hz / 100,
+             cps_hz % 100,
+             cscs_hz / 100,
+             cscs_hz % 100,
+             lat_avg ( &crank_lat ),
+             crank_lat.max_ms,
+             cps.missed + cscs.missed,
+             ctrl_sent,
+             ctrl_lost,
+             ctrl_refused,
+             lat_avg ( &ctrl_rtt ),
+             ctrl_rtt.max_ms,
+             hr_bpm );
+    printk ( "RESULT bike_sent=%u bike_completed=%u bike_skipped=%u"
+             " bike_coalesced=%u bike_dropped=%u bike_age_avg_ms=%u"
+             " bike_age_max_ms=%u bike_lat_avg_ms=%u bike_lat_max_ms=%u\n",
+             sys_le32_to_cpu ( stats->sent ),
+             sys_le32_to_cpu ( stats->completed ),
+             sys_le32_to_cpu ( stats->skipped ),
+             sys_le32_to_cpu ( stats->coalesced ),
+             sys_le32_to_cpu ( stats->dropped ),
+             sys_le16_to_cpu ( stats->age_avg_ms ),
+             sys_le16_to_cpu ( stats->age_max_ms ),
+             sys_le16_to_cpu ( stats->lat_avg_ms ),
+             sys_le16_to_cpu ( stats->lat_max_ms ) );
+}
+
+// With hr set the bike is expected to have the strap, its rate has to
+// reach FE-C and the app links have to stay within budget
+static void run_central ( bool hr )
+{
+    static struct bt_gatt_subscribe_params ftms_sub;
+    static struct bt_gatt_subscribe_params cps_sub;
+    static struct bt_gatt_subscribe_params cscs_sub;
+    static struct bt_gatt_subscribe_params ctrl_sub;
+    static struct bt_gatt_subscribe_params fec_sub;
+
+    bleStart();
+    bike = connectBike();
+    subscribe ( &ftms_sub,
+                BLE_UUID_INDOOR_BIKE_DATA_CHAR,
+                BT_GATT_CCC_NOTIFY,
+                ftms_data );
+    subscribe ( &cps_sub,
+                BLE_UUID_CYCLING_POWER_MEASUREMENT_CHAR,
+                BT_GATT_CCC_NOTIFY,
+                cps_data );
+    subscribe ( &cscs_sub,
+                BLE_UUID_CSCS_MEASUREMENT_CHAR,
+                BT_GATT_CCC_NOTIFY,
+                cscs_data );
+    subscribe ( &ctrl_sub,
+                BLUE_UUID_FITNESS_CONTROL_POINT_CHAR,
+                BT_GATT_CCC_INDICATE,
+                ctrl_data );
+    ctrl_handle = ctrl_sub.value_handle;
+    if ( hr ) {
+        subscribe (
+            &fec_sub, BLE_UUID_FEC_RX_CHAR, BT_GATT_CCC_NOTIFY, fec_data );
+    }
+    const uint16_t diag_handle
+        = findChar ( bike, BLE_UUID_DIAG_TELEMETRY_CHAR );
+
+    const uint32_t start_ms = k_uptime_get_32();
+    measuring = true;
+    write_ctrl ( OPCODE_REQUEST, NULL, 0 );
+    for ( uint32_t i = 0; k_uptime_get_32() - start_ms < MEASURE_MS; i++ ) {
+        const uint16_t watts
+            = sys_cpu_to_le16 ( ( i & 1 ) ? CTRL_HIGH_W : CTRL_LOW_W );
+        write_ctrl ( OPCODE_SET_PWR, &watts, sizeof ( watts ) );
+        k_sleep ( K_MSEC ( CTRL_PERIOD_MS ) );
+    }
+    measuring = false;
+    const uint32_t ms = k_uptime_get_32() - start_ms;
+
+    telemetry_stats_t stats = {};
+    if ( readChar ( bike, diag_handle, &stats, sizeof ( stats ) )
+         != sizeof ( stats ) ) {
+        FAIL ( "Short diagnostics read\n" );
+    }
+    report ( &stats, ms );
+
+    if ( !ftms.cnt || !cps.cnt || !cscs.cnt ) {
+        FAIL ( "Missing telemetry: ftms %u cps %u cscs %u\n",
+               ftms.cnt,
+               cps.cnt,
+               cscs.cnt );
+    } else if ( ctrl_lost ) {
+        FAIL ( "%u of %u control writes unanswered\n", ctrl_lost, ctrl_sent );
+    } else if ( hr
+                && ( !hr_cnt || ( hr_bpm < STRAP_BPM_MIN )
+                     || ( hr_bpm > STRAP_BPM_MAX ) ) ) {
+        FAIL ( "Strap heart rate missing, FE-C has %u\n", hr_bpm );
+    } else if ( hr
+                && ( sys_le16_to_cpu ( stats.lat_max_ms )
+                     > HR_LAT_BUDGET_MS ) ) {
+        FAIL ( "Notification latency %u ms over budget with the strap\n",
+               sys_le16_to_cpu ( stats.lat_max_ms ) );
+    }
+    PASS ( "Central done\n" );
+}
+
+static void test_central()
+{
+    run_central ( false );
+}
+
+static void test_central_hr()
+{
+    run_central ( true );
+}
+
+static const struct bst_test_instance tests [] = {
+    {
+        .test_id = "central",
+        .test_descr = "Subscribes to FTMS, CPS and CSCS, steps target power "
+                      "and reports rates, latencies and drops",
+        .test_post_init_f = testInit,
+        .test_tick_f = testTick,
+        .test_main_f = test_central,
+    },
+    {
+        .test_id = "central_hr",
+        .test_descr = "Same as central against a bike with a heart rate "
+                      "strap, checks the rate in FE-C and the latency budget",
+        .test_post_init_f = testInit,
+        .test_tick_f = testTick,
+        .test_main_f = test_central_hr,
+    },
+    BSTEST_END_MARKER,
+};
+
+struct bst_test_list *testCentralInstall ( struct bst_test_list *list )
+{
+    return bst_add_tests ( list, tests );
+}
@@ -0,0 +1,262 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bsim.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gap.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include "ftms.h"
+
+static struct bt_conn *bike = NULL;
+static K_SEM_DEFINE ( connected_sem, 0, 1 );
+static K_SEM_DEFINE ( gatt_sem, 0, 1 );
+static uint8_t gatt_err = 0;
+
+void testInit()
+{
+    bst_ticker_set_next_tick_absolute ( TEST_TIMEOUT_US );
+    bst_result = In_progress;
+}
+
+void testTick ( bs_time_t now )
+{
+    if ( bst_result != Passed ) {
+        FAIL ( "Still running at %" PRIu64 " us\n", now );
+    }
+}
+
+static void gatt_wait ( const char *what )
+{
+    if ( k_sem_take ( &gatt_sem, K_MSEC ( GATT_TIMEOUT_MS ) ) ) {
+        FAIL ( "%s timed out\n", what );
+    } else if ( gatt_err ) {
+        FAIL ( "%s failed (ATT err 0x%02x)\n", what, gatt_err );
+    }
+}
+
+void bleStart()
+{
+    int err = bt_enable ( NULL );
+    if ( err ) {
+        FAIL ( "Bluetooth failed to start (err %d)\n", err );
+    }
+}
+
+// Bike is whatever advertises the fitness machine service
+static bool ad_has_ftms ( struct bt_data *data, void *user_data )
+{
+    bool *found = user_data;
+    if ( ( data->type != BT_DATA_UUID16_SOME )
+         && ( data->type != BT_DATA_UUID16_ALL ) ) {
+        return true;
+    }
+    for ( size_t i = 0; i + 1 < data->data_len; i += sizeof ( uint16_t ) ) {
+        if ( sys_get_le16 ( &data->data [i] ) == BT_UUID_FTMS_VAL ) {
+            *found = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void device_found ( const bt_addr_le_t *addr,
+                           int8_t rssi,
+                           uint8_t type,
+                           struct net_buf_simple *ad )
+{
+    bool found = false;
+    if ( bike || ( type != BT_GAP_ADV_TYPE_ADV_IND ) ) {
+        return;
+    }
+    bt_data_parse ( ad, ad_has_ftms, &found );
+    if ( !found || bt_le_scan_stop() ) {
+        return;
+    }
+
+    int err = bt_conn_le_create (
+        addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT, &bike );
+    if ( err ) {
+        FAIL ( "Connection failed to start (err %d)\n", err );
+    }
+}
+
+// Centrals started together race for the same advertising event, the
+// losers go back to scanning
+static void connected ( struct bt_conn *conn, uint8_t err )
+{
+    if ( conn != bike ) {
+        return;
+    } else if ( err ) {
+        bt_conn_unref ( bike );
+        bike = NULL;
+        err = bt_le_scan_start ( BT_LE_SCAN_PASSIVE, device_found );
+        if ( err ) {
+            FAIL ( "Scanning failed to restart (err %d)\n", err );
+        }
+        return;
+    }
+    k_sem_give ( &connected_sem );
+}
+
+static void disconnected ( struct bt_conn *conn, uint8_t reason )
+{
+    if ( ( conn == bike ) && ( bst_result != Passed ) ) {
+        FAIL ( "Bike disconnected (reason 0x%02x)\n", reason );
+    }
+}
+
+BT_CONN_CB_DEFINE ( bsim_conn_callbacks )
+    = { .connected = connected, .disconnected = disconnected };
+
+static void mtu_done ( struct bt_conn *conn,
+                       uint8_t err,
+                       struct bt_gatt_exchange_params *params )
+{
+    gatt_err = err;
+    k_sem_give ( &gatt_sem );
+}
+
+// Blocks until connected with the largest MTU both sides take
+struct bt_conn *connectBike()
+{
+    static struct bt_gatt_exchange_params mtu_params = { .func = mtu_done };
+
+    int err = bt_le_scan_start ( BT_LE_SCAN_PASSIVE, device_found );
+    if ( err ) {
+        FAIL ( "Scanning failed to start (err %d)\n", err );
+    }
+    k_sem_take ( &connected_sem, K_FOREVER );
+
+    err = bt_gatt_exchange_mtu ( bike, &mtu_params );
+    if ( err ) {
+        FAIL ( "MTU exchange failed to start (err %d)\n", err );
+    }
+    gatt_wait ( "MTU exchange" );
+    return bike;
+}
+
+static uint16_t found_handle = 0;
+
+static uint8_t discovered ( struct bt_conn *conn,
+                            const struct bt_gatt_attr *attr,
+                            struct bt_gatt_discover_params *params )
+{
+    found_handle = attr ? bt_gatt_attr_value_handle ( attr ) : 0;
+    gatt_err = 0;
+    k_sem_give ( &gatt_sem );
+    return BT_GATT_ITER_STOP;
+}
+
+// Value handle of the first characteristic with this UUID
+uint16_t findChar ( struct bt_conn *conn, const struct bt_uuid *uuid )
+{
+    static struct bt_gatt_discover_params params;
+    params.uuid = uuid;
+    params.func = discovered;
+    params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+    params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+    params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+    int err = bt_gatt_discover ( conn, &params );
+    if ( err ) {
+        FAIL ( "Discovery failed to start (err %d)\n", err );
+    }
+    gatt_wait ( "Discovery" );
+    if ( !found_handle ) {
+        FAIL ( "Characteristic not found\n" );
+    }
+    return found_handle;
+}
+
+static void subscribed ( struct bt_conn *conn,
+                         uint8_t err,
+                         struct bt_gatt_subscribe_params *params )
+{
+    gatt_err = err;
+    k_sem_give ( &gatt_sem );
+}
+
+// Caller fills in the value handle, the value and the handler, the CCC is
+// found on the way
+void subscribeChar ( struct bt_conn *conn,
+                     struct bt_gatt_subscribe_params *params )
+{
+    static struct bt_gatt_discover_params disc_params;
+    params->ccc_handle = 0;
+    params->end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+    params->disc_params = &disc_params;
+    params->subscribe = subscribed;
+
+    int err = bt_gatt_subscribe ( conn, params );
+    if ( err ) {
+        FAIL ( "Subscription failed to start (err %d)\n", err );
+    }
+    gatt_wait ( "Subscription" );
+}
+
+static uint8_t *read_buf = NULL;
+static size_t read_max = 0;
+static size_t read_len = 0;
+
+static uint8_t read_done ( struct bt_conn *conn,
+                           uint8_t err,
+                           struct bt_gatt_read_params *params,
+                           const void *data,
+                           uint16_t length )
+{
+    if ( data && !err ) {
+        const size_t n = MIN ( length, read_max - read_len );
+        memcpy ( &read_buf [read_len], data, n );
+        read_len += n;
+        return BT_GATT_ITER_CONTINUE;
+    }
+    gatt_err = err;
+    k_sem_give ( &gatt_sem );
+    return BT_GATT_ITER_STOP;
+}
+
+// Long reads are followed to the end, returns the bytes copied
+size_t readChar ( struct bt_conn *conn,
+                  uint16_t handle,
+                  void *buf,
+                  size_t len )
+{
+    static struct bt_gatt_read_params params;
+    params.func = read_done;
+    params.handle_count = 1;
+    params.single.handle = handle;
+    params.single.offset = 0;
+    read_buf = buf;
+    read_max = len;
+    read_len = 0;
+
+    int err = bt_gatt_read ( conn, &params );
+    if ( err ) {
+        FAIL ( "Read failed to start (err %d)\n", err );
+    }
+    gatt_wait ( "Read" );
+    return read_len;
+}
@@ -0,0 +1,252 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bsim.h"
+
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+
+#include "broadcast.h"
+
+// Reports counted over this long once synced
+#define MEASURE_MS 20000
+
+// Sync is dropped after this long without a report, 10 ms units
+#define SYNC_TIMEOUT 100
+
+// Rate the train has to hold, in 0.01 Hz, with one report of slack
+#define RATE_MIN_X100 195
+#define RATE_MAX_X100 255
+
+// The bike updates the frame every BCAST_UPDATE_MS, so a report can be at
+// most a few changes past the last one
+#define SEQ_MAX_STEP 3
+
+// Rider input main.c generates on the simulated board
+#define GEN_RPM_MIN 80
+#define GEN_RPM_MAX 100
+#define GEN_WATTS_MIN 200
+#define GEN_WATTS_MAX 300
+
+static const uint8_t BCAST_UUID [] = { BT_UUID_BCAST_VAL };
+
+static struct bt_le_per_adv_sync *sync = NULL;
+static K_SEM_DEFINE ( synced_sem, 0, 1 );
+static uint16_t sync_interval = 0;
+static volatile bool measuring = false;
+
+// Counted from the RX thread while measuring
+static uint32_t reports = 0;
+static uint32_t valid = 0;
+static uint32_t invalid = 0;
+static uint32_t bad_version = 0;
+static uint32_t bad_seq = 0;
+static uint32_t bad_value = 0;
+static bcast_frame_t last;
+static bool have_last = false;
+
+static bool ad_has_bcast ( struct bt_data *data, void *user_data )
+{
+    bool *found = user_data;
+    if ( ( data->type != BT_DATA_UUID128_SOME )
+         && ( data->type != BT_DATA_UUID128_ALL ) ) {
+        return true;
+    }
+    for ( size_t i = 0; i + BT_UUID_SIZE_128 <= data->data_len;
+          i += BT_UUID_SIZE_128 ) {
+        if ( !memcmp ( &data->data [i], BCAST_UUID, BT_UUID_SIZE_128 ) ) {
+            *found = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+// The extended advertising only has to point at the train
+static void scan_recv ( const struct bt_le_scan_recv_info *info,
+                        struct net_buf_simple *ad )
+{
+    bool found = false;
+    if ( sync || !info->interval ) {
+        return;
+    }
+    bt_data_parse ( ad, ad_has_bcast, &found );
+    if ( !found ) {
+        return;
+    }
+
+    struct bt_le_per_adv_sync_param param = {
+        .sid = info->sid,
+        .skip = 0,
+        .timeout = SYNC_TIMEOUT,
+    };
+    bt_addr_le_copy ( &param.addr, info->addr );
+    int err = bt_le_per_adv_sync_create ( &param, &sync );
+    if ( err ) {
+        FAIL ( "Sync failed to start (err %d)\n", err );
+    }
+}
+
+static struct bt_le_scan_cb scan_cb = { .recv = scan_recv };
+
+static void synced ( struct bt_le_per_adv_sync *s,
+                     struct bt_le_per_adv_sync_synced_info *info )
+{
+    sync_interval = info->interval;
+    k_sem_give ( &synced_sem );
+}
+
+static void term ( struct bt_le_per_adv_sync *s,
+                   const struct bt_le_per_adv_sync_term_info *info )
+{
+    if ( bst_result != Passed ) {
+        FAIL ( "Sync lost (reason 0x%02x)\n", info->reason );
+    }
+}
+
+// Invalid readings are both fields at 0xFFFF, anything else has to be
+// what the bike generated
+static void check_frame ( const bcast_frame_t *f )
+{
+    const uint16_t watts = sys_le16_to_cpu ( f->watts );
+    const uint16_t rpm = sys_le16_to_cpu ( f->rpm );
+    reports++;
+    if ( f->version != BCAST_FRAME_VERSION ) {
+        bad_version++;
+    }
+    if ( ( watts == 0xFFFF ) && ( rpm == 0xFFFF ) ) {
+        invalid++;
+    } else if ( ( watts >= GEN_WATTS_MIN ) && ( watts <= GEN_WATTS_MAX )
+                && ( rpm >= GEN_RPM_MIN ) && ( rpm <= GEN_RPM_MAX ) ) {
+        valid++;
+    } else {
+        bad_value++;
+    }
+
+    // Same content keeps its seq, new content moves it on
+    if ( have_last ) {
+        bcast_frame_t prev = last;
+        prev.seq = f->seq;
+        const bool same = !memcmp ( &prev, f, sizeof ( prev ) );
+        const uint8_t step = f->seq - last.seq;
+        if ( ( same != !step ) || ( step > SEQ_MAX_STEP ) ) {
+            bad_seq++;
+        }
+    }
+    last = *f;
+    have_last = true;
+}
+
+static bool svc_data ( struct bt_data *data, void *user_data )
+{
+    if ( ( data->type != BT_DATA_SVC_DATA128 )
+         || ( data->data_len < BT_UUID_SIZE_128 )
+         || memcmp ( data->data, BCAST_UUID, BT_UUID_SIZE_128 ) ) {
+        return true;
+    }
+    if ( data->data_len != BT_UUID_SIZE_128 + sizeof ( bcast_frame_t ) ) {
+        bad_value++;
+        return false;
+    }
+    bcast_frame_t f;
+    memcpy ( &f, &data->data [BT_UUID_SIZE_128], sizeof ( f ) );
+    check_frame ( &f );
+    return false;
+}
+
+static void per_recv ( struct bt_le_per_adv_sync *s,
+                       const struct bt_le_per_adv_sync_recv_info *info,
+                       struct net_buf_simple *buf )
+{
+    if ( measuring ) {
+        bt_data_parse ( buf, svc_data, NULL );
+    }
+}
+
+static struct bt_le_per_adv_sync_cb sync_cb = {
+    .synced = synced,
+    .term = term,
+    .recv = per_recv,
+};
+
+// Syncs to the bike's periodic train like a display or a second app would
+static void test_observer()
+{
+    bleStart();
+    bt_le_scan_cb_register ( &scan_cb );
+    bt_le_per_adv_sync_cb_register ( &sync_cb );
+    int err = bt_le_scan_start ( BT_LE_SCAN_PASSIVE, NULL );
+    if ( err ) {
+        FAIL ( "Scanning failed to start (err %d)\n", err );
+    }
+    k_sem_take ( &synced_sem, K_FOREVER );
+    bt_le_scan_stop();
+
+    measuring = true;
+    k_sleep ( K_MSEC ( MEASURE_MS ) );
+    measuring = false;
+
+    const uint32_t rate_x100 = reports * 100000 / MEASURE_MS;
+    printk ( "RESULT bcast_hz=%u.%02u bcast_interval_ms=%u bcast_valid=%u"
+             " bcast_invalid=%u\n",
+             rate_x100 / 100,
+             rate_x100 % 100,
+             sync_interval * 5 / 4,
+             valid,
+             invalid );
+
+    if ( ( sync_interval < BCAST_PER_INT_MIN )
+         || ( sync_interval > BCAST_PER_INT_MAX ) ) {
+        FAIL ( "Periodic interval %u out of range\n", sync_interval );
+    } else if ( ( rate_x100 < RATE_MIN_X100 )
+                || ( rate_x100 > RATE_MAX_X100 ) ) {
+        FAIL ( "%u reports in %u ms\n", reports, MEASURE_MS );
+    } else if ( bad_version || bad_seq || bad_value ) {
+        FAIL ( "Bad frames: %u version, %u seq, %u value\n",
+               bad_version,
+               bad_seq,
+               bad_value );
+    } else if ( !valid || !invalid ) {
+        FAIL ( "Expected both readings and gaps, %u valid, %u invalid\n",
+               valid,
+               invalid );
+    }
+    PASS ( "Observer done\n" );
+}
+
+static const struct bst_test_instance tests [] = {
+    {
+        .test_id = "bcast_observer",
+        .test_descr = "Syncs to the telemetry broadcast, checks the frame "
+                      "version, sequence, rate and invalid encoding",
+        .test_post_init_f = testInit,
+        .test_tick_f = testTick,
+        .test_main_f = test_observer,
+    },
+    BSTEST_END_MARKER,
+};
+
+struct bst_test_list *testObserverInstall ( struct bst_test_list *list )
+{
+    return bst_add_tests ( list, tests );
+}
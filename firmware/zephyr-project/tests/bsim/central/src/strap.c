@@ -0,0 +1,90 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bsim.h"
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/services/hrs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+// Strap side of the heart rate test, runs this long then passes
+#define STRAP_RUN_MS 45000
+#define STRAP_PERIOD_MS 1000
+
+static const struct bt_data ad [] = {
+    BT_DATA_BYTES ( BT_DATA_FLAGS, ( BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR ) ),
+    BT_DATA_BYTES ( BT_DATA_UUID16_ALL,
+                    BT_UUID_16_ENCODE ( BT_UUID_HRS_VAL ) ),
+};
+
+static uint32_t connections = 0;
+
+static void connected ( struct bt_conn *conn, uint8_t err )
+{
+    if ( !err ) {
+        connections++;
+    }
+}
+
+BT_CONN_CB_DEFINE ( strap_conn_callbacks ) = { .connected = connected };
+
+// Advertises like a chest strap and notifies once a second
+static void test_strap()
+{
+    bleStart();
+    int err
+        = bt_le_adv_start ( BT_LE_ADV_CONN, ad, ARRAY_SIZE ( ad ), NULL, 0 );
+    if ( err ) {
+        FAIL ( "Advertising failed to start (err %d)\n", err );
+    }
+
+    uint32_t sent = 0;
+    for ( uint32_t i = 0; i < STRAP_RUN_MS / STRAP_PERIOD_MS; i++ ) {
+        const uint16_t bpm
+            = STRAP_BPM_MIN + i % ( STRAP_BPM_MAX - STRAP_BPM_MIN + 1 );
+        if ( !bt_hrs_notify ( bpm ) ) {
+            sent++;
+        }
+        k_sleep ( K_MSEC ( STRAP_PERIOD_MS ) );
+    }
+
+    if ( !connections || !sent ) {
+        FAIL ( "Bike never read the strap (%u connections, %u sent)\n",
+               connections,
+               sent );
+    }
+    PASS ( "Strap done, %u measurements sent\n", sent );
+}
+
+static const struct bst_test_instance tests [] = {
+    {
+        .test_id = "strap",
+        .test_descr = "Heart rate strap for the bike's central role",
+        .test_post_init_f = testInit,
+        .test_tick_f = testTick,
+        .test_main_f = test_strap,
+    },
+    BSTEST_END_MARKER,
+};
+
+struct bst_test_list *testStrapInstall ( struct bst_test_list *list )
+{
+    return bst_add_tests ( list, tests );
+}
@@ -0,0 +1,328 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bsim.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+
+#include "ftms.h"
+
+// SMP characteristic, image upload is group 1 command 1
+#define SMP_CHAR_UUID                                                 \
+    BT_UUID_DECLARE_128 ( BT_UUID_128_ENCODE (                        \
+        0xda2e7828, 0xfbce, 0x4e01, 0xae9e, 0x261174997c48 ) )
+#define SMP_OP_WRITE 2
+#define SMP_OP_WRITE_RSP 3
+#define SMP_GROUP_IMAGE 1
+#define SMP_ID_UPLOAD 1
+
+// Full sized image for the slot in boards/nrf52_bsim.overlay, sent in
+// chunks that fit one mcumgr buffer with a few requests in flight like
+// the phone libraries do
+#define UPLOAD_SIZE ( 384 * 1024 )
+#define UPLOAD_CHUNK 2048
+#define UPLOAD_WINDOW 3
+#define UPLOAD_RSP_TIMEOUT_MS 5000
+
+// MCUboot image header, checked on the first chunk
+#define IMAGE_MAGIC 0x96f3b83d
+#define IMAGE_HDR_SIZE 32
+
+typedef struct __attribute__ ( ( __packed__ ) )
+{
+    uint8_t op;
+    uint8_t flags;
+    uint16_t len;  // Big endian, like the group
+    uint16_t group;
+    uint8_t seq;
+    uint8_t id;
+} smp_hdr_t;
+
+typedef struct
+{
+    int32_t rc;
+    uint32_t off;
+} smp_rsp_t;
+
+K_MSGQ_DEFINE ( rsp_q, sizeof ( smp_rsp_t ), UPLOAD_WINDOW * 2, 4 );
+
+static struct bt_conn *bike = NULL;
+static uint16_t smp_handle = 0;
+static bool uploading = false;
+static uint32_t telemetry_cnt = 0;
+
+// Just enough CBOR for the upload request and its response
+static uint8_t *cbor_head ( uint8_t *p, uint8_t major, uint32_t val )
+{
+    major <<= 5;
+    if ( val < 24 ) {
+        *p++ = major | val;
+    } else if ( val <= UINT8_MAX ) {
+        *p++ = major | 24;
+        *p++ = val;
+    } else if ( val <= UINT16_MAX ) {
+        *p++ = major | 25;
+        sys_put_be16 ( val, p );
+        p += 2;
+    } else {
+        *p++ = major | 26;
+        sys_put_be32 ( val, p );
+        p += 4;
+    }
+    return p;
+}
+
+static uint8_t *cbor_key ( uint8_t *p, const char *key )
+{
+    const size_t len = strlen ( key );
+    p = cbor_head ( p, 3, len );
+    memcpy ( p, key, len );
+    return p + len;
+}
+
+static const uint8_t *cbor_read ( const uint8_t *p,
+                                  const uint8_t *end,
+                                  uint8_t *major,
+                                  uint32_t *val )
+{
+    if ( p >= end ) {
+        return NULL;
+    }
+    *major = *p >> 5;
+    const uint8_t info = *p++ & 0x1F;
+    const size_t len = info < 24 ? 0 : BIT ( info - 24 );
+    if ( ( info > 26 ) || ( p + len > end ) ) {
+        return NULL;
+    }
+    *val = ( info < 24 )   ? info
+           : ( len == 1 ) ? p [0]
+           : ( len == 2 ) ? sys_get_be16 ( p )
+                          : sys_get_be32 ( p );
+    return p + len;
+}
+
+// Response map, only "rc" and "off" matter
+static bool parse_rsp ( const uint8_t *p, const uint8_t *end, smp_rsp_t *rsp )
+{
+    uint8_t major;
+    uint32_t cnt;
+    p = cbor_read ( p, end, &major, &cnt );
+    if ( !p || ( major != 5 ) ) {
+        return false;
+    }
+    rsp->rc = 0;
+    rsp->off = UINT32_MAX;
+    for ( uint32_t i = 0; i < cnt; i++ ) {
+        uint32_t len;
+        uint32_t val;
+        p = cbor_read ( p, end, &major, &len );
+        if ( !p || ( major != 3 ) || ( p + len > end ) ) {
+            return false;
+        }
+        const uint8_t *key = p;
+        p = cbor_read ( p + len, end, &major, &val );
+        if ( !p ) {
+            return false;
+        } else if ( ( major == 2 ) || ( major == 3 ) ) {
+            p += val;
+            continue;
+        }
+        const int32_t num = ( major == 1 ) ? -1 - ( int32_t )val : val;
+        if ( ( len == 2 ) && !memcmp ( key, "rc", 2 ) ) {
+            rsp->rc = num;
+        } else if ( ( len == 3 ) && !memcmp ( key, "off", 3 ) ) {
+            rsp->off = val;
+        }
+    }
+    return true;
+}
+
+static uint8_t smp_data ( struct bt_conn *conn,
+                          struct bt_gatt_subscribe_params *params,
+                          const void *data,
+                          uint16_t length )
+{
+    const smp_hdr_t *hdr = data;
+    smp_rsp_t rsp;
+    if ( !data ) {
+        return BT_GATT_ITER_STOP;
+    } else if ( ( length < sizeof ( *hdr ) )
+                || ( hdr->op != SMP_OP_WRITE_RSP )
+                || ( sys_be16_to_cpu ( hdr->group ) != SMP_GROUP_IMAGE )
+                || ( hdr->id != SMP_ID_UPLOAD ) ) {
+        return BT_GATT_ITER_CONTINUE;
+    }
+    const uint8_t *body = ( const uint8_t * )data + sizeof ( *hdr );
+    if ( !parse_rsp ( body, body + length - sizeof ( *hdr ), &rsp ) ) {
+        rsp.rc = -1;
+    }
+    k_msgq_put ( &rsp_q, &rsp, K_NO_WAIT );
+    return BT_GATT_ITER_CONTINUE;
+}
+
+// Telemetry should stay quiet while the image has the link
+static uint8_t ftms_data ( struct bt_conn *conn,
+                           struct bt_gatt_subscribe_params *params,
+                           const void *data,
+                           uint16_t length )
+{
+    if ( !data ) {
+        return BT_GATT_ITER_STOP;
+    } else if ( uploading ) {
+        telemetry_cnt++;
+    }
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static void image_data ( uint8_t *buf, uint32_t off, size_t len )
+{
+    for ( size_t i = 0; i < len; i++ ) {
+        buf [i] = off + i;
+    }
+    if ( off ) {
+        return;
+    }
+    memset ( buf, 0, IMAGE_HDR_SIZE );
+    sys_put_le32 ( IMAGE_MAGIC, &buf [0] );
+    sys_put_le16 ( IMAGE_HDR_SIZE, &buf [8] );
+    sys_put_le32 ( UPLOAD_SIZE - IMAGE_HDR_SIZE, &buf [12] );
+}
+
+// One SMP frame, split over as many writes as the MTU needs and put back
+// together by the bike
+static void send_chunk ( uint32_t off, uint8_t seq )
+{
+    static uint8_t frame [UPLOAD_CHUNK + 64];
+    const size_t len = MIN ( UPLOAD_CHUNK, UPLOAD_SIZE - off );
+
+    uint8_t *p = frame + sizeof ( smp_hdr_t );
+    p = cbor_head ( p, 5, off ? 2 : 3 );
+    if ( !off ) {
+        p = cbor_key ( p, "len" );
+        p = cbor_head ( p, 0, UPLOAD_SIZE );
+    }
+    p = cbor_key ( p, "off" );
+    p = cbor_head ( p, 0, off );
+    p = cbor_key ( p, "data" );
+    p = cbor_head ( p, 2, len );
+    image_data ( p, off, len );
+    p += len;
+
+    smp_hdr_t *hdr = ( void * )frame;
+    hdr->op = SMP_OP_WRITE;
+    hdr->flags = 0;
+    hdr->len = sys_cpu_to_be16 ( p - frame - sizeof ( *hdr ) );
+    hdr->group = sys_cpu_to_be16 ( SMP_GROUP_IMAGE );
+    hdr->seq = seq;
+    hdr->id = SMP_ID_UPLOAD;
+
+    const size_t max = bt_gatt_get_mtu ( bike ) - 3;
+    for ( const uint8_t *w = frame; w < p; ) {
+        const size_t n = MIN ( max, ( size_t )( p - w ) );
+        int err
+            = bt_gatt_write_without_response ( bike, smp_handle, w, n, false );
+        if ( err == -ENOMEM ) {
+            k_sleep ( K_MSEC ( 1 ) );
+            continue;
+        } else if ( err ) {
+            FAIL ( "SMP write failed (err %d)\n", err );
+        }
+        w += n;
+    }
+}
+
+static void test_upload()
+{
+    static struct bt_gatt_subscribe_params smp_sub;
+    static struct bt_gatt_subscribe_params ftms_sub;
+
+    bleStart();
+    bike = connectBike();
+    smp_sub.value_handle = findChar ( bike, SMP_CHAR_UUID );
+    smp_sub.value = BT_GATT_CCC_NOTIFY;
+    smp_sub.notify = smp_data;
+    subscribeChar ( bike, &smp_sub );
+    smp_handle = smp_sub.value_handle;
+    ftms_sub.value_handle = findChar ( bike, BLE_UUID_INDOOR_BIKE_DATA_CHAR );
+    ftms_sub.value = BT_GATT_CCC_NOTIFY;
+    ftms_sub.notify = ftms_data;
+    subscribeChar ( bike, &ftms_sub );
+
+    uint32_t sent_off = 0;
+    uint32_t acked_off = 0;
+    uint8_t in_flight = 0;
+    uint8_t seq = 0;
+    const uint32_t start_ms = k_uptime_get_32();
+    while ( acked_off < UPLOAD_SIZE ) {
+        while ( ( in_flight < UPLOAD_WINDOW ) && ( sent_off < UPLOAD_SIZE ) ) {
+            send_chunk ( sent_off, seq++ );
+            sent_off += MIN ( UPLOAD_CHUNK, UPLOAD_SIZE - sent_off );
+            in_flight++;
+        }
+
+        smp_rsp_t rsp;
+        if ( k_msgq_get ( &rsp_q, &rsp, K_MSEC ( UPLOAD_RSP_TIMEOUT_MS ) ) ) {
+            FAIL ( "No upload response at offset %u\n", acked_off );
+        }
+        const uint32_t want
+            = acked_off + MIN ( UPLOAD_CHUNK, UPLOAD_SIZE - acked_off );
+        if ( rsp.rc || ( rsp.off != want ) ) {
+            FAIL ( "Upload refused at %u: rc %d off %u\n",
+                   acked_off,
+                   rsp.rc,
+                   rsp.off );
+        }
+        // Anything after the first answer was sent with telemetry paused
+        uploading = true;
+        acked_off = want;
+        in_flight--;
+    }
+    uploading = false;
+    const uint32_t ms = k_uptime_get_32() - start_ms;
+
+    printk ( "RESULT upload_bytes=%u upload_ms=%u upload_bps=%u"
+             " telemetry_during_upload=%u\n",
+             UPLOAD_SIZE,
+             ms,
+             ( uint32_t )( ( uint64_t )UPLOAD_SIZE * 1000 / MAX ( ms, 1 ) ),
+             telemetry_cnt );
+    PASS ( "Upload done\n" );
+}
+
+static const struct bst_test_instance tests [] = {
+    {
+        .test_id = "upload",
+        .test_descr = "Uploads a full image over SMP and reports the time",
+        .test_post_init_f = testInit,
+        .test_tick_f = testTick,
+        .test_main_f = test_upload,
+    },
+    BSTEST_END_MARKER,
+};
+
+struct bst_test_list *testUploadInstall ( struct bst_test_list *list )
+{
+    return bst_add_tests ( list, tests );
+}
@@ -0,0 +1,72 @@
+# Universal Bike Controller
+# Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Shared by the BabbleSim scripts, sourced rather than run
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must point to the Zephyr tree}"
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must point to the BabbleSim build}"
+: "${BSIM_COMPONENTS_PATH:?BSIM_COMPONENTS_PATH must point to its components}"
+
+TEST_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+APP_DIR=$(cd "${TEST_DIR}/../.." && pwd)
+BSIM_BIN=${BSIM_OUT_PATH}/bin
+BUILD_DIR=${BUILD_DIR:-${BSIM_OUT_PATH}/ubike}
+LOG_DIR=${LOG_DIR:-${BUILD_DIR}/logs}
+
+BIKE_EXE=bs_nrf52_bsim_ubike
+BIKE_HRS_EXE=bs_nrf52_bsim_ubike_hrs
+BIKE_BCAST_EXE=bs_nrf52_bsim_ubike_bcast
+CENTRAL_EXE=bs_nrf52_bsim_ubike_central
+
+# build <name> <source dir> [cmake args], leaves bs_nrf52_bsim_<name> next
+# to the phy
+build() {
+    local name=$1 src=$2
+    shift 2
+    west build -p always -b nrf52_bsim -d "${BUILD_DIR}/${name}" "${src}" \
+        -- "$@" || exit 1
+    cp "${BUILD_DIR}/${name}/zephyr/zephyr.exe" \
+        "${BSIM_BIN}/bs_nrf52_bsim_${name}" || exit 1
+}
+
+# run_sim <sim id> <simulated us> <bike exe> <test id>..., the bike is
+# device 0 and every test id gets a central image of its own. Fails when
+# any scripted device does.
+run_sim() {
+    local sim_id=$1 length_us=$2 bike=$3
+    shift 3
+    local logs=${LOG_DIR}/${sim_id}
+    local pids=() dev=1 rc=0
+    mkdir -p "${logs}"
+    cd "${BSIM_BIN}" || exit 1
+
+    "./${bike}" -s="${sim_id}" -d=0 -rs=1 > "${logs}/bike.log" 2>&1 &
+    for id in "$@"; do
+        "./${CENTRAL_EXE}" -s="${sim_id}" -d=${dev} -rs=$((dev + 1)) \
+            -testid="${id}" > "${logs}/dev${dev}.log" 2>&1 &
+        pids+=($!)
+        dev=$((dev + 1))
+    done
+    ./bs_2G4_phy_v1 -s="${sim_id}" -D=${dev} -sim_length="${length_us}" \
+        > "${logs}/phy.log" 2>&1
+
+    for pid in "${pids[@]}"; do
+        wait "${pid}" || rc=1
+    done
+    wait
+    grep -h "^RESULT" "${logs}"/dev*.log
+    return ${rc}
+}
@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# Universal Bike Controller
+# Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Builds the bike and the scripted devices for nrf52_bsim
+
+source "$(dirname "${BASH_SOURCE[0]}")/common.sh"
+
+build ubike "${APP_DIR}"
+build ubike_central "${TEST_DIR}/central"
+build ubike_hrs "${APP_DIR}" -DOVERLAY_CONFIG=overlay-hrs.conf
+
+# Cadence replies stop for 4 s of every 10 s and are published as invalid
+build ubike_bcast "${APP_DIR}" -DOVERLAY_CONFIG=overlay-broadcast.conf \
+    "-DEXTRA_CFLAGS=-DSAMPLE_RPM_POLICY=SAMPLE_INVALID -DBSIM_RPM_GAP_MS=4000"
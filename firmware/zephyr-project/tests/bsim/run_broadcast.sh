@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# Universal Bike Controller
+# Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Bike with the broadcast overlay and one observer synced to its periodic
+# train. The observer checks the frame version, the sequence number, the
+# 2 to 2.5 Hz rate and that cadence gaps go out as 0xFFFF.
+#
+# ./compile.sh && ./run_broadcast.sh
+
+source "$(dirname "${BASH_SOURCE[0]}")/common.sh"
+
+run_sim ubike_bcast 60e6 "${BIKE_BCAST_EXE}" bcast_observer
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# Universal Bike Controller
+# Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Bike with the strap overlay, a simulated chest strap and one app. The bike
+# has to find the strap while the app is connected, pass its rate on in
+# FE-C and keep the app's notification latency within budget.
+#
+# ./compile.sh && ./run_hrs.sh
+
+source "$(dirname "${BASH_SOURCE[0]}")/common.sh"
+
+run_sim ubike_hrs 60e6 "${BIKE_HRS_EXE}" strap central_hr
@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+# Universal Bike Controller
+# Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Notification rate, crank event to air latency, control point round trips
+# and drop counts with several apps on one bike. Every central prints its
+# own RESULT lines, bike_* figures come from the diagnostics service.
+#
+# ./compile.sh && CENTRALS=3 ./run_telemetry.sh
+
+source "$(dirname "${BASH_SOURCE[0]}")/common.sh"
+
+CENTRALS=${CENTRALS:-2}
+centrals=()
+for ((i = 0; i < CENTRALS; i++)); do
+    centrals+=(central)
+done
+
+run_sim ubike_telemetry 60e6 "${BIKE_EXE}" "${centrals[@]}"
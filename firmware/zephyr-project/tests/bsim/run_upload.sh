@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# Universal Bike Controller
+# Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Time to upload a full image over SMP. The bike logs its own rate and how
+# many chunks were received while the previous one was written to flash.
+#
+# ./compile.sh && ./run_upload.sh
+
+source "$(dirname "${BASH_SOURCE[0]}")/common.sh"
+
+run_sim ubike_upload 60e6 "${BIKE_EXE}" upload
+rc=$?
+grep -h "Upload complete\|Upload chunks" "${LOG_DIR}/ubike_upload/bike.log"
+exit ${rc}
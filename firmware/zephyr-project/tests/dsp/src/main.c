@@ -0,0 +1,98 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "dsp.h"
+
+// Same filter as the cadence stage
+static const int32_t COEFFS [5] = { DSP_Q31 ( 0.0976310729 ),
+                                    DSP_Q31 ( 0.1952621459 ),
+                                    DSP_Q31 ( 0.0976310729 ),
+                                    DSP_Q31 ( 0.9428090416 ),
+                                    DSP_Q31 ( -0.3333333333 ) };
+
+// 90 rpm then 60 rpm in Q16, worked out with exact integer arithmetic
+static const int32_t STEP_OUT [20] = {
+    575851,  2270472, 4252077, 5555478, 6123801, 6225154, 6131270,
+    6008971, 5924961, 5886522, 5686334, 5126507, 4473476, 4044401,
+    3857543, 3824396, 3855431, 3895740, 3923399, 3936040,
+};
+
+#define BENCH_SAMPLES 1000
+
+ZTEST ( dsp, test_biquad_vectors )
+{
+    dsp_biquad_t f;
+    dsp_biquad_init ( &f, COEFFS, 0 );
+    for ( size_t i = 0; i < ARRAY_SIZE ( STEP_OUT ); i++ ) {
+        const int32_t x = ( i < 10 ? 90 : 60 ) << DSP_CADENCE_SHIFT;
+        zassert_equal ( dsp_biquad_q31 ( &f, x ),
+                        STEP_OUT [i],
+                        "Sample %u differs",
+                        i );
+    }
+
+    // Starting over gives the same output
+    dsp_biquad_init ( &f, COEFFS, 0 );
+    zassert_equal ( dsp_biquad_q31 ( &f, 90 << DSP_CADENCE_SHIFT ),
+                    STEP_OUT [0] );
+}
+
+ZTEST ( dsp, test_window_mean )
+{
+    static uint16_t buf [4];
+    dsp_window_t w = { buf, ARRAY_SIZE ( buf ), 0, 0, 0 };
+    dsp_window_reset ( &w );
+    zassert_equal ( dsp_window_mean ( &w ), 0 );
+
+    // Partly filled windows average what they have
+    dsp_window_push ( &w, 100 );
+    dsp_window_push ( &w, 201 );
+    zassert_equal ( dsp_window_mean ( &w ), 151 );
+
+    // Full windows drop the oldest
+    dsp_window_push ( &w, 300 );
+    dsp_window_push ( &w, 300 );
+    dsp_window_push ( &w, 300 );
+    zassert_equal ( dsp_window_mean ( &w ), 275 );
+}
+
+// Reports the same figures the diagnostics service serves
+ZTEST ( dsp, test_benchmark )
+{
+    for ( uint32_t i = 0; i < BENCH_SAMPLES; i++ ) {
+        dspUpdate ( 200 + i % 50, 80 + i % 20, i * DSP_SAMPLE_MS );
+    }
+    const dsp_stats_t stats = dspGetStats();
+    zassert_equal ( stats.samples, BENCH_SAMPLES );
+    TC_PRINT ( "%u samples, counter at %u Hz\n",
+               stats.samples,
+               stats.cyc_hz );
+    TC_PRINT ( "window: %u cycles/sample (max %u)\n",
+               stats.window_last_cyc,
+               stats.window_max_cyc );
+    TC_PRINT ( "biquad: %u cycles/sample (max %u)\n",
+               stats.biquad_last_cyc,
+               stats.biquad_max_cyc );
+    zassert_equal ( dspGetCadence(), 97 );
+    zassert_equal ( dspGetPower3s(), 247 );
+}
+
+ZTEST_SUITE ( dsp, NULL, NULL, NULL, NULL, NULL );
@@ -0,0 +1,228 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "erg.h"
+#include "powerModel.h"
+
+// Emulation steps, the controller runs once per main loop cycle like on
+// the bike, right after the cadence read
+#define STEP_MS 10
+#define CYCLE_MS 500
+
+// Riders take a moment to change cadence
+#define CADENCE_TAU_MS 300
+
+// Settled once power stays within this band of where it ends up
+#define BAND_PCT 5
+
+// The controller is feed-forward only, so where the plant ends up is off
+// the target by the model mismatch
+#define TRACK_MAX_PCT 15
+
+// Targets from the request
+#define SETTLE_MAX_MS 2000
+#define OVERSHOOT_MAX_PCT 10
+
+#define LEAD_IN_MS 10000
+#define OBSERVE_MS 6000
+
+// Plant the controller never sees, not the powerModel.c fit it inverts.
+// Another unit's coast-down: eddy drag off by -7 to +8% per anchor and
+// interpolated linearly, more Coulomb friction, a lossier drivetrain and
+// a brake magnet that takes a moment to move.
+#define PLANT_FLY_PER_CRANK 5.317
+#define PLANT_TC_BASE 0.40
+#define PLANT_TC_PER_LVL 0.018
+#define PLANT_ETA 0.93
+#define MAGNET_TAU_MS 150
+
+static const double PLANT_K_LVLS [] = { 1, 4, 10, 13, 16, 18, 20, 22 };
+static const double PLANT_K [] = { 0.0324, 0.0334, 0.0436, 0.0663,
+                                   0.0708, 0.1191, 0.1045, 0.1700 };
+
+static double plant_k ( double lvl )
+{
+    size_t i = 1;
+    while ( ( i < ARRAY_SIZE ( PLANT_K_LVLS ) - 1 )
+            && ( lvl > PLANT_K_LVLS [i] ) ) {
+        i++;
+    }
+    const double t = ( lvl - PLANT_K_LVLS [i - 1] )
+                     / ( PLANT_K_LVLS [i] - PLANT_K_LVLS [i - 1] );
+    return PLANT_K [i - 1] + t * ( PLANT_K [i] - PLANT_K [i - 1] );
+}
+
+// Resistance writes are acked straight away like misc-scripts/sim-bike.py
+typedef struct
+{
+    double rpm;
+    double rider_rpm;
+    uint16_t res_mag;
+    double magnet;  // Magnitude the brake is actually at
+} bike_emu_t;
+
+typedef struct
+{
+    uint32_t settle_ms;
+    uint32_t overshoot_pct;
+    uint32_t track_pct;  // Where power ends up against the target
+} erg_result_t;
+
+static double emu_watts ( const bike_emu_t *bike )
+{
+    const double lvl = RES_MIN_LVL
+                       + ( bike->magnet - RES_MIN_MAG ) / RES_MAG_PER_LVL;
+    const double k = plant_k ( lvl );
+    const double tc = PLANT_TC_BASE + PLANT_TC_PER_LVL * lvl;
+    const double omega = bike->rpm * PLANT_FLY_PER_CRANK * 2.0 * M_PI / 60.0;
+    return ( k * omega * omega + tc * omega ) / PLANT_ETA;
+}
+
+static void emu_step ( bike_emu_t *bike, uint32_t t_ms )
+{
+    bike->rpm += ( bike->rider_rpm - bike->rpm ) * STEP_MS / CADENCE_TAU_MS;
+    bike->magnet += ( bike->res_mag - bike->magnet ) * STEP_MS / MAGNET_TAU_MS;
+    if ( !( t_ms % CYCLE_MS ) ) {
+        bike->res_mag = ergUpdate ( ( uint16_t )lround ( bike->rpm ) );
+    }
+}
+
+static void emu_run ( bike_emu_t *bike, uint32_t ms )
+{
+    for ( uint32_t t = 0; t < ms; t += STEP_MS ) {
+        emu_step ( bike, t );
+    }
+}
+
+static uint32_t track_pct ( double power, uint16_t watts )
+{
+    return ( uint32_t )lround ( fabs ( power - watts ) * 100 / watts );
+}
+
+// The change lands just before t = 0, power is followed until OBSERVE_MS.
+// Settling and overshoot are against where power ends up, the last
+// second, since only that is down to the controller.
+static erg_result_t observe ( bike_emu_t *bike, uint16_t watts )
+{
+    static double power [OBSERVE_MS / STEP_MS];
+    const size_t tail = 1000 / STEP_MS;
+    double final = 0.0;
+    for ( size_t i = 0; i < ARRAY_SIZE ( power ); i++ ) {
+        power [i] = emu_watts ( bike );
+        emu_step ( bike, i * STEP_MS );
+        if ( i >= ARRAY_SIZE ( power ) - tail ) {
+            final += power [i] / tail;
+        }
+    }
+
+    erg_result_t res = { 0, 0, track_pct ( final, watts ) };
+    int sign = 0;
+    bool crossed = false;
+    double worst = 0.0;
+    for ( size_t i = 0; i < ARRAY_SIZE ( power ); i++ ) {
+        const double err = power [i] - final;
+        if ( fabs ( err ) * 100 > final * BAND_PCT ) {
+            res.settle_ms = ( i + 1 ) * STEP_MS;
+        }
+
+        // Overshoot is travel past the final value after the first crossing
+        if ( !sign && ( fabs ( err ) * 100 > final * BAND_PCT ) ) {
+            sign = err > 0 ? 1 : -1;
+        } else if ( sign && !crossed && ( err * sign <= 0 ) ) {
+            crossed = true;
+        }
+        if ( crossed && ( -err * sign > worst ) ) {
+            worst = -err * sign;
+        }
+    }
+    res.overshoot_pct = ( uint32_t )lround ( worst * 100 / final );
+    return res;
+}
+
+static erg_result_t cadence_step ( uint16_t watts, double from, double to )
+{
+    bike_emu_t bike = { from, from, RES_MIN_MAG, RES_MIN_MAG };
+    ergStart ( watts, bike.res_mag );
+    emu_run ( &bike, LEAD_IN_MS );
+    zassert_true ( track_pct ( emu_watts ( &bike ), watts ) <= TRACK_MAX_PCT,
+                   "%.0f W before the step",
+                   emu_watts ( &bike ) );
+
+    bike.rider_rpm = to;
+    const erg_result_t res = observe ( &bike, watts );
+    TC_PRINT ( "%u W, %.0f -> %.0f rpm: settled in %u ms, overshoot %u%%, "
+               "off by %u%%\n",
+               watts,
+               from,
+               to,
+               res.settle_ms,
+               res.overshoot_pct,
+               res.track_pct );
+    return res;
+}
+
+static void check ( const erg_result_t *res )
+{
+    zassert_true ( res->settle_ms <= SETTLE_MAX_MS );
+    zassert_true ( res->overshoot_pct <= OVERSHOOT_MAX_PCT );
+    zassert_true ( res->track_pct <= TRACK_MAX_PCT );
+}
+
+ZTEST ( erg, test_cadence_drop )
+{
+    const erg_result_t res = cadence_step ( 200, 90, 70 );
+    check ( &res );
+}
+
+ZTEST ( erg, test_cadence_rise )
+{
+    const erg_result_t res = cadence_step ( 200, 70, 100 );
+    check ( &res );
+}
+
+ZTEST ( erg, test_cadence_high_power )
+{
+    const erg_result_t res = cadence_step ( 350, 95, 80 );
+    check ( &res );
+}
+
+// Target changes go through the rate limit, no settling target for these
+ZTEST ( erg, test_target_step )
+{
+    bike_emu_t bike = { 90, 90, RES_MIN_MAG, RES_MIN_MAG };
+    ergStart ( 150, bike.res_mag );
+    emu_run ( &bike, LEAD_IN_MS );
+
+    ergStart ( 250, bike.res_mag );
+    const erg_result_t res = observe ( &bike, 250 );
+    TC_PRINT ( "150 -> 250 W at 90 rpm: settled in %u ms, overshoot %u%%, "
+               "off by %u%%\n",
+               res.settle_ms,
+               res.overshoot_pct,
+               res.track_pct );
+    zassert_true ( res.settle_ms < OBSERVE_MS - 1000 );
+    zassert_true ( res.overshoot_pct <= OVERSHOOT_MAX_PCT );
+    zassert_true ( res.track_pct <= TRACK_MAX_PCT );
+    zassert_equal ( ergGetTarget(), 250 );
+}
+
+ZTEST_SUITE ( erg, NULL, NULL, NULL, NULL, NULL );
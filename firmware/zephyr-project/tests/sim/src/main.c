@@ -0,0 +1,93 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "cycles.h"
+#include "powerModel.h"
+#include "sim.h"
+
+#define BENCH_SAMPLES 1000
+
+// Per cadence sample, from the request
+#define SAMPLE_BUDGET_US 100
+
+// Every test starts on the flat with the default road
+static void before ( void *fixture )
+{
+    simSetParams ( 0, SIM_DEFAULT_CRR, SIM_DEFAULT_CW );
+    simSetGrade ( 0 );
+}
+
+ZTEST ( sim, test_params_applied )
+{
+    const uint16_t flat = simUpdate ( 90 );
+
+    // Each write is picked up by the next sample
+    simSetGrade ( 200 );
+    const uint16_t climb = simUpdate ( 90 );
+    zassert_true ( climb > flat, "%u on 2%% vs %u flat", climb, flat );
+    simSetParams ( 5000, 0xFF, 0xFF );
+    zassert_true ( simUpdate ( 90 ) > climb );
+
+    // Fields left out keep their values
+    const sim_params_t p = simGetParams();
+    zassert_equal ( p.grade, 200 );
+    zassert_equal ( p.wind_mmps, 5000 );
+    zassert_equal ( p.crr, SIM_DEFAULT_CRR );
+    zassert_equal ( p.cw, SIM_DEFAULT_CW );
+
+    // Stopped pedals leave the brake at its lightest
+    zassert_equal ( simUpdate ( 0 ), RES_MIN_MAG );
+}
+
+// Meaningful with CONFIG_TIMING_FUNCTIONS on hardware, native builds run
+// in simulated time
+ZTEST ( sim, test_benchmark )
+{
+    const uint32_t cyc_hz = cyclesInit();
+
+    // Trig and the power table rebuild, once per parameter change
+    simSetGrade ( 300 );
+    uint64_t start_cyc = cyclesNow();
+    simUpdate ( 85 );
+    const uint32_t change_cyc = cyclesSince ( start_cyc );
+
+    uint32_t last_cyc = 0;
+    uint32_t max_cyc = 0;
+    for ( uint32_t i = 0; i < BENCH_SAMPLES; i++ ) {
+        start_cyc = cyclesNow();
+        simUpdate ( 40 + i % 80 );
+        last_cyc = cyclesSince ( start_cyc );
+        max_cyc = MAX ( max_cyc, last_cyc );
+    }
+    const uint32_t max_us = ( uint64_t )max_cyc * 1000000 / cyc_hz;
+    TC_PRINT ( "Counter at %u Hz\n", cyc_hz );
+    TC_PRINT ( "change: %u cycles\n", change_cyc );
+    TC_PRINT ( "sample: %u cycles (max %u, %u us)\n",
+               last_cyc,
+               max_cyc,
+               max_us );
+    zassert_true ( max_us <= SAMPLE_BUDGET_US,
+                   "%u us per sample is over budget",
+                   max_us );
+}
+
+ZTEST_SUITE ( sim, NULL, NULL, before, NULL, NULL );
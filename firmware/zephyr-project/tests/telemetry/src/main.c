@@ -0,0 +1,151 @@
+/*
+ * Universal Bike Controller
+ * Copyright (C) 2022-2023, Greco Engineering Solutions LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/ztest.h>
+
+#include "cycles.h"
+#include "ftms.h"
+
+// Old per-UUID notify path against the attribute the publisher caches,
+// on a table laid out like the FTMS service
+#define BENCH_SENDS 1000
+
+BT_GATT_SERVICE_DEFINE (
+    bench_svc,
+    BT_GATT_PRIMARY_SERVICE ( BT_UUID_FTMS ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_FTMS_FEATURE_CHAR,
+                             BT_GATT_CHRC_READ,
+                             BT_GATT_PERM_READ,
+                             NULL,
+                             NULL,
+                             NULL ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_INDOOR_BIKE_DATA_CHAR,
+                             BT_GATT_CHRC_NOTIFY,
+                             BT_GATT_PERM_NONE,
+                             NULL,
+                             NULL,
+                             NULL ),
+    BT_GATT_CCC ( NULL, ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_TRAINING_STATUS_CHAR,
+                             BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+                             BT_GATT_PERM_READ,
+                             NULL,
+                             NULL,
+                             NULL ),
+    BT_GATT_CCC ( NULL, ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ),
+    BT_GATT_CHARACTERISTIC ( BLUE_UUID_SUPPORTED_INCLINATION_RANGE_CHAR,
+                             BT_GATT_CHRC_READ,
+                             BT_GATT_PERM_READ,
+                             NULL,
+                             NULL,
+                             NULL ),
+    BT_GATT_CHARACTERISTIC ( BLUE_UUID_SUPPORTED_RESISTANCE_RANGE_CHAR,
+                             BT_GATT_CHRC_READ,
+                             BT_GATT_PERM_READ,
+                             NULL,
+                             NULL,
+                             NULL ),
+    BT_GATT_CHARACTERISTIC ( BLUE_UUID_SUPPORTED_POWER_RANGE_CHAR,
+                             BT_GATT_CHRC_READ,
+                             BT_GATT_PERM_READ,
+                             NULL,
+                             NULL,
+                             NULL ),
+    BT_GATT_CHARACTERISTIC ( BLUE_UUID_FITNESS_CONTROL_POINT_CHAR,
+                             BT_GATT_CHRC_WRITE | BT_GATT_CHRC_INDICATE,
+                             BT_GATT_PERM_WRITE,
+                             NULL,
+                             NULL,
+                             NULL ),
+    BT_GATT_CCC ( NULL, ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ),
+    BT_GATT_CHARACTERISTIC ( BLE_UUID_FTMS_STATUS_CHAR,
+                             BT_GATT_CHRC_NOTIFY,
+                             BT_GATT_PERM_NONE,
+                             NULL,
+                             NULL,
+                             NULL ),
+    BT_GATT_CCC ( NULL, ( BT_GATT_PERM_READ | BT_GATT_PERM_WRITE ) ), );
+
+typedef struct
+{
+    uint32_t last_cyc;
+    uint32_t max_cyc;
+} bench_t;
+
+static void add ( bench_t *b, uint64_t start_cyc )
+{
+    b->last_cyc = cyclesSince ( start_cyc );
+    b->max_cyc = MAX ( b->max_cyc, b->last_cyc );
+}
+
+// Nobody is subscribed, so both paths walk the table and return without
+// touching the radio, which leaves only the cost that differs
+static void bench ( const char *name, const struct bt_uuid *uuid )
+{
+    static const uint8_t payload [8] = {};
+    const struct bt_gatt_attr *attr = bt_gatt_find_by_uuid (
+        bench_svc.attrs, bench_svc.attr_count, uuid );
+    zassert_not_null ( attr );
+    struct bt_gatt_notify_params params = {
+        .attr = attr,
+        .data = payload,
+        .len = sizeof ( payload ),
+    };
+
+    bench_t by_uuid = {};
+    bench_t cached = {};
+    for ( uint32_t i = 0; i < BENCH_SENDS; i++ ) {
+        uint64_t start_cyc = cyclesNow();
+        const int uuid_rc = bt_gatt_notify_uuid (
+            NULL, uuid, bench_svc.attrs, payload, sizeof ( payload ) );
+        add ( &by_uuid, start_cyc );
+
+        start_cyc = cyclesNow();
+        const int cached_rc = bt_gatt_notify_cb ( NULL, &params );
+        add ( &cached, start_cyc );
+        zassert_equal ( uuid_rc, cached_rc, "%s send %u differs", name, i );
+    }
+    TC_PRINT ( "%s by UUID: %u cycles/send (max %u)\n",
+               name,
+               by_uuid.last_cyc,
+               by_uuid.max_cyc );
+    TC_PRINT ( "%s cached: %u cycles/send (max %u)\n",
+               name,
+               cached.last_cyc,
+               cached.max_cyc );
+}
+
+ZTEST ( telemetry, test_notify_benchmark )
+{
+    TC_PRINT ( "Counter at %u Hz\n", cyclesInit() );
+    bench ( "Indoor bike data", BLE_UUID_INDOOR_BIKE_DATA_CHAR );
+    bench ( "Machine status", BLE_UUID_FTMS_STATUS_CHAR );
+}
+
+static void *setup()
+{
+    zassert_ok ( bt_enable ( NULL ) );
+    return NULL;
+}
+
+ZTEST_SUITE ( telemetry, NULL, setup, NULL, NULL, NULL );